@@ -143,9 +143,11 @@ static void splay_tree_splay (splay_tree sp, splay_tree_key key, splay_tree_valu
 	  rotate_left (&sp->root, n, c);
 	else
 	  rotate_right (&sp->root, n, c);
+	sp->rotations++;
         return;
       }
 
+    sp->rotations += 2;
     if (cmp1 < 0 && cmp2 < 0)
       {
 	rotate_left (&n->left, c, c->left);
@@ -223,6 +225,7 @@ splay_tree splay_tree_new_with_allocator (splay_tree_compare_fn compare_fn,
   sp->allocate = allocate_fn;
   sp->deallocate = deallocate_fn;
   sp->allocate_data = allocate_data;
+  sp->rotations = sp->inserts = sp->removes = sp->nodes = 0;
   
   return sp;
 }
@@ -246,6 +249,7 @@ splay_tree_node splay_tree_insert (splay_tree sp, splay_tree_key key, splay_tree
     	(*sp->delete_value)(sp->root->value);
      sp->root->value = value;
      sp->root->key = key;
+     sp->root->site = 0;
    } 
   else 
     {
@@ -256,6 +260,9 @@ splay_tree_node splay_tree_insert (splay_tree sp, splay_tree_key key, splay_tree
                                sp->allocate_data));
       node->key = key;
       node->value = value;
+      node->site = 0;
+      sp->inserts++;
+      sp->nodes++;
       if (!sp->root)
 	node->left = node->right = 0;
       else if (comparison < 0)
@@ -289,6 +296,8 @@ void splay_tree_remove (splay_tree sp, splay_tree_key key)
       if (sp->delete_value)
 	(*sp->delete_value) (sp->root->value);
       (*sp->deallocate) (sp->root, sp->allocate_data);
+      sp->removes++;
+      sp->nodes--;
       if (left)
 	{
 	  sp->root = left;
@@ -315,6 +324,47 @@ splay_tree_node splay_tree_lookup (splay_tree sp, splay_tree_key key)
 }
 
 
+/* Number of nodes on the longest path from the root. Walks the whole tree,
+   so it is meant for statistics only. */
+uint64_t splay_tree_depth (splay_tree sp)
+{
+  uint64_t depth = 0, size = 0, capacity = 64;
+  splay_tree_node *nodes = (splay_tree_node *) malloc (capacity * sizeof (splay_tree_node));
+  uint64_t *depths = (uint64_t *) malloc (capacity * sizeof (uint64_t));
+  if (sp->root)
+    {
+      nodes[0] = sp->root;
+      depths[0] = 1;
+      size = 1;
+    }
+  while (size > 0)
+    {
+      splay_tree_node n = nodes[--size];
+      uint64_t d = depths[size];
+      if (d > depth)
+	depth = d;
+      if (size + 2 > capacity)
+	{
+	  capacity *= 2;
+	  nodes = (splay_tree_node *) realloc (nodes, capacity * sizeof (splay_tree_node));
+	  depths = (uint64_t *) realloc (depths, capacity * sizeof (uint64_t));
+	}
+      if (n->left)
+	{
+	  nodes[size] = n->left;
+	  depths[size++] = d + 1;
+	}
+      if (n->right)
+	{
+	  nodes[size] = n->right;
+	  depths[size++] = d + 1;
+	}
+    }
+  free (nodes);
+  free (depths);
+  return depth;
+}
+
 uintptr_t splay_tree_foreach (splay_tree sp, splay_tree_foreach_fn fn, void *data){
   return splay_tree_foreach_helper (sp, sp->root, fn, data);
 }
@@ -57,6 +57,8 @@ typedef void (*splay_tree_deallocate_fn) (void *, void *);
 struct splay_tree_node_s {
   splay_tree_key key;
   splay_tree_value value;
+  /* Allocation site of the block, 0 if unknown. */
+  splay_tree_value site;
   splay_tree_node left;
   splay_tree_node right;
 };
@@ -69,6 +71,12 @@ struct splay_tree_s {
   splay_tree_allocate_fn allocate;
   splay_tree_deallocate_fn deallocate;
   void *allocate_data;
+  /* Statistics: rotations done while splaying, nodes inserted, removed and
+     currently in the tree. */
+  uint64_t rotations;
+  uint64_t inserts;
+  uint64_t removes;
+  uint64_t nodes;
 };
 
 typedef struct splay_tree_s *splay_tree;
@@ -95,6 +103,7 @@ extern splay_tree_node splay_tree_insert (splay_tree,
 					  splay_tree_value);
 extern void splay_tree_remove	(splay_tree, splay_tree_key);
 extern splay_tree_node splay_tree_lookup (splay_tree, splay_tree_key);
+extern uint64_t splay_tree_depth (splay_tree);
 extern int splay_tree_splay_compare_for_delete(splay_tree_node, splay_tree_key);
 extern int splay_tree_compare(splay_tree_node, splay_tree_key, splay_tree_value);
 extern int splay_tree_compare_ints (splay_tree_node, splay_tree_key);
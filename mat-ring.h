@@ -0,0 +1,104 @@
+//Shared memory ring used to stream memory accesses from the PIN tool to an
+//external analyzer while the program runs (-ring_dir). Every traced thread
+//owns one ring, which is a file <ring_dir>/mat.<pid>.<exec>.<tid>.ring:
+//
+//  offset 0     MatRingHeader (256 bytes)
+//  offset 256   capacity * MatRingRecord (48 bytes each)
+//
+//The tool is the only producer and advances head, the analyzer is the only
+//consumer and advances tail. Both counters only grow; record i is stored
+//in slot i & (capacity - 1). head is published with release semantics after
+//the record is written, tail after the record has been read. When the tool
+//is done with a ring it sets closed; the consumer drains and unlinks it.
+//Rings of an image replaced by exec are never closed: they are done once a
+//ring of the same pid with a higher exec count exists.
+//magic is set last when a ring is created, a consumer must wait for it.
+//
+//Records carry the same fields as a line of memtrace.txt.
+
+#ifndef MAT_RING_H
+#define MAT_RING_H
+
+#include <stdint.h>
+
+#define MAT_RING_MAGIC   0x474e4952u   //"RING"
+#define MAT_RING_VERSION 1
+
+//What the tool does when the consumer falls behind and the ring is full
+#define MAT_RING_BLOCK   0   //wait for the consumer, drop after a timeout
+#define MAT_RING_DROP    1   //drop the access and count it in dropped
+#define MAT_RING_SAMPLE  2   //record only every sample-th access until the
+                             //ring is half empty again, count the rest in skipped
+
+struct MatRingRecord {
+  uint64_t ip;
+  uint64_t ea;
+  uint64_t offset;      //ea - block
+  uint64_t block;       //start address of the memory block
+  uint64_t blockSize;
+  uint32_t size;        //size of the access
+  uint32_t isRead;
+};
+
+struct MatRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t capacity;    //number of records, a power of two
+  uint32_t pid;
+  uint32_t tid;
+  uint32_t policy;
+  uint32_t closed;
+  uint64_t dropped;
+  uint64_t skipped;
+  uint8_t  pad0[64 - 48];
+  uint64_t head;        //written by the tool
+  uint8_t  pad1[64 - 8];
+  uint64_t tail;        //written by the consumer
+  uint8_t  pad2[64 - 8];
+  uint8_t  pad3[64];
+};
+
+#define MAT_RING_HEADER_SIZE 256
+
+static inline struct MatRingRecord *MatRingRecords(struct MatRingHeader *h)
+{
+  return (struct MatRingRecord *) ((char *) h + MAT_RING_HEADER_SIZE);
+}
+
+static inline uint64_t MatRingSize(uint32_t capacity)
+{
+  return MAT_RING_HEADER_SIZE + (uint64_t) capacity * sizeof(struct MatRingRecord);
+}
+
+//Number of records the consumer has not read yet
+static inline uint64_t MatRingUsed(struct MatRingHeader *h)
+{
+  return __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+}
+
+//Producer: returns 0 if the ring is full
+static inline int MatRingPush(struct MatRingHeader *h, const struct MatRingRecord *r)
+{
+  uint64_t head = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+  if (head - __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE) >= h->capacity)
+    return 0;
+  MatRingRecords(h)[head & (h->capacity - 1)] = *r;
+  __atomic_store_n(&h->head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+//Consumer: copy up to n records, returns the number of records copied
+static inline uint64_t MatRingPop(struct MatRingHeader *h, struct MatRingRecord *out, uint64_t n)
+{
+  uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+  uint64_t avail = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) - tail;
+  if (n > avail)
+    n = avail;
+  for (uint64_t i = 0; i < n; i++)
+    out[i] = MatRingRecords(h)[(tail + i) & (h->capacity - 1)];
+  __atomic_store_n(&h->tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+#endif
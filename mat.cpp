@@ -1,8 +1,16 @@
 #include <signal.h>
 #include <map>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "splay-tree.h"
+#include "mat-ring.h"
 #include <set>
+#include <unordered_map>
+#include <string.h>
+#include <vector>
 
 #include "pin.H"
 #include "instlib.H"
@@ -20,8 +28,6 @@
 
 static std::map<ADDRINT,ADDRINT> allocations;
 static unsigned int threshold = 0;
-static std::map<ADDRINT, int> ip_map;
-static std::map<ADDRINT, std::string> sourcelines;
 
 using namespace INSTLIB;
 FILTER filter;
@@ -32,12 +38,368 @@ TLS_KEY buf_key;
 
 BOOL EnableInstrumentation = TRUE;
 
-FILE *traceFile;
-FILE *ipFile;
+//Output files: memtrace<shard>.txt and sourcelines<shard>.txt in the output
+//directory. %p in the shard template is replaced by the pid, %e by the exec
+//count and %t by the thread id, which gives one pair of files per thread.
+//Processes traced at the same time into one directory (e.g. MPI ranks
+//started as separate pin processes) get their pid appended automatically.
+KNOB<std::string> KnobOutputDir(KNOB_MODE_WRITEONCE, "pintool", "o", ".", "output directory");
+KNOB<std::string> KnobShard(KNOB_MODE_WRITEONCE, "pintool", "shard", "", "suffix of the output files, e.g. .%p.%t");
+KNOB<UINT32> KnobExecSeq(KNOB_MODE_WRITEONCE, "pintool", "exec_seq", "0", "number of execs before this image (set for followed children)");
+
+//Instead of memtrace files, stream accesses through one shared memory ring
+//per thread (see mat-ring.h) to an analyzer such as postprocessing/mat-live
+KNOB<std::string> KnobRingDir(KNOB_MODE_WRITEONCE, "pintool", "ring_dir", "", "directory for shared memory rings, e.g. /dev/shm");
+KNOB<UINT32> KnobRingSize(KNOB_MODE_WRITEONCE, "pintool", "ring_size", "1048576", "records per ring");
+KNOB<std::string> KnobRingPolicy(KNOB_MODE_WRITEONCE, "pintool", "ring_policy", "drop", "if a ring is full: drop, sample or block (waits for the consumer up to ring_timeout)");
+KNOB<UINT32> KnobRingTimeout(KNOB_MODE_WRITEONCE, "pintool", "ring_timeout", "1000", "ms a blocked thread waits for the consumer before it drops, 0 to wait forever (hangs without a consumer)");
+KNOB<UINT32> KnobRingSample(KNOB_MODE_WRITEONCE, "pintool", "ring_sample", "16", "record every n-th access while sampling");
+
+//Label blocks by the call stack of their allocation: the site ID is written
+//as 8th column of memtrace and the sites are listed in allocsites<shard>.txt
+KNOB<UINT32> KnobSiteDepth(KNOB_MODE_WRITEONCE, "pintool", "site_depth", "0", "frames of the allocation call stack hashed into a site ID, 0 to disable");
+
+//Counters of the tool itself, written to matstats<shard>.txt at exit and
+//whenever the stats signal arrives. The signal is not passed on to the
+//program, so pick one the program does not use.
+KNOB<INT32> KnobStatsSignal(KNOB_MODE_WRITEONCE, "pintool", "stats_signal", "0", "signal that writes the tool statistics and is not delivered to the program, e.g. 30 (SIGPWR); 0 to disable");
+KNOB<BOOL> KnobStatsCycles(KNOB_MODE_WRITEONCE, "pintool", "stats_cycles", "0", "count the cycles spent in lookup and output");
+
+//Memory trace and sourcelines of one shard
+struct Output {
+  THREADID tid;
+  BOOL open;
+  FILE *traceFile;
+  MatRingHeader *ring;
+  BOOL sampling;
+  UINT64 sampleCount;
+  BOOL stalled;
+  std::map<ADDRINT, int> ip_map;
+  std::map<ADDRINT, std::string> sourcelines;
+};
+
+static BOOL perThread = FALSE;
+static BOOL forked = FALSE;
+static BOOL sharedDir = FALSE;
+static BOOL ringMode = FALSE;
+static UINT32 ringPolicy = MAT_RING_DROP;
+static UINT32 ringSample = 16;
+static UINT32 ringTimeout = 1000;
+static Output *sharedOutput = 0;
+static std::vector<Output *> outputs;
+static std::vector<std::string> pinArgs;
+
+//Per thread counters, one cache line each. Allocations are counted by the
+//tree, which is shared by all threads.
+struct __attribute__((aligned(64))) Stats {
+  UINT64 accesses;      //calls of Record(), each looks up the allocation tree
+  UINT64 misses;        //accesses outside of tracked blocks, not recorded
+  UINT64 bytes;         //bytes written to memtrace or the ring
+  UINT64 lookupCycles;
+  UINT64 outputCycles;
+};
+static Stats stats[PIN_MAX_THREADS];
+static BOOL statsCycles = FALSE;
+
+//Allocation sites. Call stacks are deduplicated by their raw return
+//addresses first; only a new stack is resolved into image relative frames,
+//whose hash is the site ID and stays the same across runs.
+#define MAX_SITE_DEPTH 16
+static UINT32 siteDepth = 0;
+static PIN_LOCK siteLock;
+static std::unordered_map<UINT64, UINT32> stackSites;
+static std::map<UINT32, std::string> sites;
 
 static splay_tree  tree = splay_tree_new((splay_tree_compare_fn) splay_tree_compare_ints,
                                    0,0);
 
+//Expand the shard template. Forked children, exec'd images and processes
+//sharing the output directory always get their pid and exec count into
+//the name, so they do not overwrite the files of each other. Files of the
+//whole process (tid INVALID_THREADID) have no thread in their name.
+static std::string ShardName(const char *base, THREADID tid){
+  std::string t = KnobShard.Value();
+  if (tid == INVALID_THREADID) {
+    size_t pos;
+    while ((pos = t.find("%t")) != std::string::npos) {
+      size_t from = pos > 0 && strchr("._-", t[pos - 1]) ? pos - 1 : pos;
+      t.erase(from, pos + 2 - from);
+    }
+  } else if (perThread && t.find("%t") == std::string::npos)
+    t += ".%t";
+  if ((forked || sharedDir || KnobExecSeq.Value() > 0) && t.find("%p") == std::string::npos)
+    t += ".%p";
+  if (KnobExecSeq.Value() > 0 && t.find("%e") == std::string::npos)
+    t += ".%e";
+
+  std::stringstream ss;
+  ss << KnobOutputDir.Value() << "/" << base;
+  for (size_t i = 0; i < t.size(); i++) {
+    if (t[i] != '%' || i + 1 == t.size()) {
+      ss << t[i];
+      continue;
+    }
+    switch (t[++i]) {
+      case 'p': ss << PIN_GetPid(); break;
+      case 'e': ss << KnobExecSeq.Value(); break;
+      case 't': ss << tid; break;
+      default:  ss << t[i];
+    }
+  }
+  ss << ".txt";
+  return ss.str();
+}
+
+static MatRingHeader *OpenRing(THREADID tid){
+  std::stringstream ss;
+  ss << KnobRingDir.Value() << "/mat." << PIN_GetPid() << "." << KnobExecSeq.Value() << "." << tid << ".ring";
+  UINT32 capacity = 1;
+  while (capacity < KnobRingSize.Value())
+    capacity <<= 1;
+
+  int fd = open(ss.str().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return 0;
+  if (ftruncate(fd, MatRingSize(capacity)) != 0) {
+    close(fd);
+    return 0;
+  }
+  void *m = mmap(0, MatRingSize(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    return 0;
+
+  MatRingHeader *h = (MatRingHeader *) m;
+  h->version = MAT_RING_VERSION;
+  h->recordSize = sizeof(MatRingRecord);
+  h->capacity = capacity;
+  h->pid = PIN_GetPid();
+  h->tid = tid;
+  h->policy = ringPolicy;
+  __atomic_store_n(&h->magic, MAT_RING_MAGIC, __ATOMIC_RELEASE);
+  return h;
+}
+
+//Open a new shard. fileLock must not be held
+static Output *OpenOutput(THREADID tid){
+  Output *out = new Output;
+  out->tid = tid;
+  out->open = TRUE;
+  out->traceFile = 0;
+  out->ring = 0;
+  out->sampling = FALSE;
+  out->sampleCount = 0;
+  out->stalled = FALSE;
+  if (ringMode)
+    out->ring = OpenRing(tid);
+  if (!out->ring) {
+    if (ringMode)
+      std::cerr << "Cannot create ring in " << KnobRingDir.Value() << ", writing memtrace instead" << std::endl;
+    out->traceFile = fopen(ShardName("memtrace", tid).c_str(), "w");
+  }
+
+  PIN_GetLock(&fileLock, tid + 1);
+  outputs.push_back(out);
+  PIN_ReleaseLock(&fileLock);
+  return out;
+}
+
+static VOID WriteSourcelines(Output *out){
+  FILE *ipFile = fopen(ShardName("sourcelines", out->tid).c_str(), "w");
+  for(auto it: out->sourcelines)
+      fprintf(ipFile, "%lu %s\n", it.first, it.second.c_str());
+  fclose(ipFile);
+}
+
+//Write the sourcelines of a shard and close it. fileLock must be held
+static VOID CloseOutput(Output *out){
+  if (!out->open)
+    return;
+  WriteSourcelines(out);
+  if (out->ring) {
+    __atomic_store_n(&out->ring->closed, 1, __ATOMIC_RELEASE);
+    munmap(out->ring, MatRingSize(out->ring->capacity));
+    out->ring = 0;
+  } else {
+    fclose(out->traceFile);
+    out->traceFile = 0;
+  }
+  out->open = FALSE;
+}
+
+//Hand an access to the consumer of the ring, if it falls behind apply the
+//ring policy
+static inline UINT32 RingWrite(Output *out, const MatRingRecord &r){
+  MatRingHeader *h = out->ring;
+  if (out->sampling) {
+    if (++out->sampleCount % ringSample != 0) {
+      h->skipped++;
+      return 0;
+    }
+    if (MatRingUsed(h) <= h->capacity / 2)
+      out->sampling = FALSE;
+  }
+  //A blocked thread that timed out drops accesses until the ring has room
+  //again, so a consumer that died costs one timeout and not one per access
+  UINT32 waited = 0;
+  while (!MatRingPush(h, &r)) {
+    if (ringPolicy == MAT_RING_DROP || out->stalled) {
+      h->dropped++;
+      return 0;
+    }
+    if (ringPolicy == MAT_RING_SAMPLE) {
+      out->sampling = TRUE;
+      out->sampleCount = 0;
+      h->skipped++;
+      return 0;
+    }
+    if (ringTimeout && waited >= ringTimeout) {
+      out->stalled = TRUE;
+      h->dropped++;
+      return 0;
+    }
+    PIN_Sleep(1);
+    waited++;
+  }
+  out->stalled = FALSE;
+  return sizeof(r);
+}
+
+static inline UINT64 HashStep(UINT64 h, UINT64 x){
+  return (h ^ x) * 0x100000001B3ULL;
+}
+
+//Site of an allocation seen at the return of the allocation function: the
+//return address is on top of the stack, the callers are found by following
+//the frame pointers. The walk stops at the first frame that does not look
+//like one (code built without frame pointers), which makes the site less
+//specific but never slow.
+static UINT32 AllocSite(ADDRINT sp, ADDRINT fp){
+  if (siteDepth == 0)
+    return 0;
+  ADDRINT frames[MAX_SITE_DEPTH];
+  UINT32 n = 0;
+  if (PIN_SafeCopy(&frames[0], (VOID *) sp, sizeof(ADDRINT)) != sizeof(ADDRINT))
+    return 0;
+  n++;
+  while (n < siteDepth && fp > sp && fp - sp < (1 << 24) && (fp & (sizeof(ADDRINT) - 1)) == 0) {
+    ADDRINT frame[2];   //saved frame pointer, return address
+    if (PIN_SafeCopy(frame, (VOID *) fp, sizeof(frame)) != sizeof(frame) || frame[1] == 0)
+      break;
+    frames[n++] = frame[1];
+    if (frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+
+  UINT64 raw = 0xcbf29ce484222325ULL;
+  for (UINT32 i = 0; i < n; i++)
+    raw = HashStep(raw, frames[i]);
+
+  PIN_GetLock(&siteLock, 1);
+  auto it = stackSites.find(raw);
+  if (it != stackSites.end()) {
+    UINT32 site = it->second;
+    PIN_ReleaseLock(&siteLock);
+    return site;
+  }
+
+  UINT64 h = 0xcbf29ce484222325ULL;
+  std::stringstream ss;
+  PIN_LockClient();
+  for (UINT32 i = 0; i < n; i++) {
+    IMG img = IMG_FindByAddress(frames[i]);
+    std::string image = "?";
+    ADDRINT offset = frames[i];
+    if (IMG_Valid(img)) {
+      image = IMG_Name(img);
+      image = image.substr(image.rfind('/') + 1);
+      offset -= IMG_LowAddress(img);
+    }
+    for (char c : image)
+      h = HashStep(h, (unsigned char) c);
+    h = HashStep(h, offset);
+
+    std::string filename;
+    INT32 line = 0;
+    PIN_GetSourceLocation(frames[i], NULL, &line, &filename);
+    ss << " " << image << "+0x" << std::hex << offset << std::dec;
+    if (!filename.empty())
+      ss << "@" << filename.substr(filename.rfind('/') + 1) << ":" << line;
+  }
+  PIN_UnlockClient();
+
+  //The top bit is set, so sites never collide with the address ranks that
+  //blocks without a site (site 0) get as block ID
+  UINT32 site = (UINT32) (h ^ (h >> 32)) | 0x80000000u;
+  stackSites[raw] = site;
+  sites.insert(std::make_pair(site, ss.str()));
+  PIN_ReleaseLock(&siteLock);
+  return site;
+}
+
+//One line per allocation site: site ID, then image+offset@file:line of every frame
+static VOID WriteSites(){
+  if (siteDepth == 0)
+    return;
+  FILE *f = fopen(ShardName("allocsites", INVALID_THREADID).c_str(), "w");
+  if (!f)
+    return;
+  PIN_GetLock(&siteLock, 1);
+  for (auto &it : sites)
+    fprintf(f, "%u%s\n", it.first, it.second.c_str());
+  PIN_ReleaseLock(&siteLock);
+  fclose(f);
+}
+
+//Write the counters of all threads and of the allocation tree. The depth
+//of the tree is only computed at exit, as it needs a walk over the whole
+//tree. fileLock must be held
+static VOID WriteStats(const char *reason, BOOL depth){
+  static BOOL first = TRUE;
+  FILE *f = fopen(ShardName("matstats", INVALID_THREADID).c_str(), first ? "w" : "a");
+  if (!f)
+    return;
+  first = FALSE;
+
+  Stats total;
+  memset(&total, 0, sizeof(total));
+  fprintf(f, "# %s\n# thread tid accesses misses bytes lookupCycles outputCycles\n", reason);
+  for (THREADID t = 0; t < PIN_MAX_THREADS; t++) {
+    const Stats &s = stats[t];
+    if (s.accesses == 0)
+      continue;
+    fprintf(f, "thread %u %lu %lu %lu %lu %lu\n", t, (long unsigned) s.accesses, (long unsigned) s.misses,
+            (long unsigned) s.bytes, (long unsigned) s.lookupCycles, (long unsigned) s.outputCycles);
+    total.accesses += s.accesses;
+    total.misses += s.misses;
+    total.bytes += s.bytes;
+    total.lookupCycles += s.lookupCycles;
+    total.outputCycles += s.outputCycles;
+  }
+  fprintf(f, "total %lu %lu %lu %lu %lu\n", (long unsigned) total.accesses, (long unsigned) total.misses,
+          (long unsigned) total.bytes, (long unsigned) total.lookupCycles, (long unsigned) total.outputCycles);
+  fprintf(f, "tree nodes %lu inserts %lu removes %lu rotations %lu", (long unsigned) tree->nodes,
+          (long unsigned) tree->inserts, (long unsigned) tree->removes, (long unsigned) tree->rotations);
+  if (depth)
+    fprintf(f, " depth %lu", (long unsigned) splay_tree_depth(tree));
+  fprintf(f, "\n");
+  fclose(f);
+
+  if (depth && total.accesses)
+    std::cerr << "MAT: " << total.accesses << " accesses, " << total.misses << " ("
+              << 100.0 * total.misses / total.accesses << "%) outside of tracked blocks, "
+              << tree->inserts << " blocks tracked, " << total.bytes << " bytes written" << std::endl;
+}
+
+//Request the statistics while the program runs. The interrupted thread may
+//hold fileLock, so they are written by the next access that is recorded.
+static volatile INT32 statsRequested = 0;
+BOOL StatsHandler(THREADID tid, INT32, CONTEXT *, BOOL, const EXCEPTION_INFO *, void *){
+  statsRequested = 1;
+  return FALSE;
+}
+
 //SignalHandler do enable instrumentation for memory accesses
 BOOL SignalHandler1(THREADID, INT32, CONTEXT *, BOOL, const EXCEPTION_INFO *, void *){
   std::cout << "Instrumenation enabled" << std::endl;
@@ -47,8 +409,13 @@ BOOL SignalHandler1(THREADID, INT32, CONTEXT *, BOOL, const EXCEPTION_INFO *, vo
 }
 
 //SignalerHandler do disable instrumentation for memory accesses
-BOOL SignalHandler2(THREADID, INT32, CONTEXT *, BOOL, const EXCEPTION_INFO *, void *){
-  fprintf(traceFile, "0 0\n");
+BOOL SignalHandler2(THREADID tid, INT32, CONTEXT *, BOOL, const EXCEPTION_INFO *, void *){
+  PIN_GetLock(&fileLock, tid + 1);
+  //Rings have a single producer, only file outputs get the marker
+  for (auto out : outputs)
+    if (out->traceFile)
+      fprintf(out->traceFile, "0 0\n");
+  PIN_ReleaseLock(&fileLock);
   std::cout << "Instrumenation disabled" << std::endl;
   EnableInstrumentation = FALSE;
 //  PIN_RemoveInstrumentation();
@@ -57,10 +424,18 @@ BOOL SignalHandler2(THREADID, INT32, CONTEXT *, BOOL, const EXCEPTION_INFO *, vo
 
 //Record data entries into file TODO: compression and binary output for optimization
 static std::map<ADDRINT, std::string> string_of_instructions;
-VOID Record(ADDRINT ip, ADDRINT ea, UINT32 size, BOOL type)
+VOID Record(THREADID tid, ADDRINT ip, ADDRINT ea, UINT32 size, BOOL type)
 {
+   Output *out = perThread ? static_cast<Output *>(PIN_GetThreadData(buf_key, tid)) : sharedOutput;
+
+   if (statsRequested && __sync_bool_compare_and_swap(&statsRequested, 1, 0)) {
+     PIN_GetLock(&fileLock, tid + 1);
+     WriteStats("signal", FALSE);
+     PIN_ReleaseLock(&fileLock);
+   }
+
    //Get sourceline of the corresponding ip
-   auto it = ip_map.insert(std::make_pair(ip,1));
+   auto it = out->ip_map.insert(std::make_pair(ip,1));
    if (it.second){
        //string_of_instructions[addr] = INS_Disassemble(addr);
        //std::map<ADDRINT,std::string>::const_iterator it = sourcelines.find(ip);
@@ -73,17 +448,38 @@ VOID Record(ADDRINT ip, ADDRINT ea, UINT32 size, BOOL type)
       PIN_UnlockClient();
       std::stringstream ss;
       ss << filename << ":" << line;
-      sourcelines[ip] = ss.str();
+      out->sourcelines[ip] = ss.str();
    }
 
+   Stats &st = stats[tid];
+   st.accesses++;
+   UINT64 start = statsCycles ? PIN_ReadCycleCounter() : 0;
+
    splay_tree_node n = splay_tree_lookup(tree, ea);
    uint64_t tmp = -1;
+   if (statsCycles) {
+     UINT64 now = PIN_ReadCycleCounter();
+     st.lookupCycles += now - start;
+     start = now;
+   }
 
    if( n != 0){
      tmp = ea - n->key;
-     fprintf(traceFile, "%lu %lu %lu %lu %d %d %lu\n", (long unsigned) ip, (long unsigned) ea, tmp, n->key, type, size, n->value - n->key);
-
+     int written;
+     if (out->ring) {
+       MatRingRecord r = { ip, ea, tmp, n->key, n->value - n->key, size, type };
+       written = RingWrite(out, r);
+     } else if (siteDepth)
+       written = fprintf(out->traceFile, "%lu %lu %lu %lu %d %d %lu %lu\n", (long unsigned) ip, (long unsigned) ea, tmp, n->key, type, size, n->value - n->key, n->site);
+     else
+       written = fprintf(out->traceFile, "%lu %lu %lu %lu %d %d %lu\n", (long unsigned) ip, (long unsigned) ea, tmp, n->key, type, size, n->value - n->key);
+     if (written > 0)
+       st.bytes += written;
+     if (statsCycles)
+       st.outputCycles += PIN_ReadCycleCounter() - start;
     } 
+   else
+     st.misses++;
    //else //if corresponding allocation cannot be found
    //   fprintf(traceFile, "%lu %lu -1 -1 %d\n", (long unsigned) ip, (long unsigned) ea, type);
 }
@@ -98,6 +494,7 @@ BOOL InstrumentMemAccess (INS ins){
  if (INS_MemoryOperandIsRead(ins, memOp) && !INS_IsStackRead(ins))
     INS_InsertPredicatedCall(
         ins, IPOINT_BEFORE, (AFUNPTR)Record,
+        IARG_THREAD_ID,
         IARG_INST_PTR, 
         IARG_MEMORYREAD_EA, 
         IARG_MEMORYREAD_SIZE, 
@@ -107,6 +504,7 @@ BOOL InstrumentMemAccess (INS ins){
  if (INS_MemoryOperandIsWritten(ins, memOp) && !INS_IsStackWrite(ins))
     INS_InsertPredicatedCall(
         ins, IPOINT_BEFORE, (AFUNPTR)Record, 
+        IARG_THREAD_ID,
         IARG_INST_PTR, 
         IARG_MEMORYWRITE_EA, 
         IARG_MEMORYWRITE_SIZE,  
@@ -125,9 +523,9 @@ VOID alloc_before(size_t size){
      malloc_size = size;
 }
 
-VOID alloc_after(ADDRINT addr){
+VOID alloc_after(ADDRINT addr, ADDRINT sp, ADDRINT fp){
    if( malloc_size > threshold) 
-     splay_tree_insert(tree, (splay_tree_key) addr, (splay_tree_value) addr+malloc_size);
+     splay_tree_insert(tree, (splay_tree_key) addr, (splay_tree_value) addr+malloc_size)->site = AllocSite(sp, fp);
 }
 
 static intptr_t sbrk_size = 0;
@@ -169,9 +567,9 @@ VOID calloc_before(size_t n, size_t size){
    calloc_size = n*size;
 }
 
-VOID calloc_after(ADDRINT addr){
+VOID calloc_after(ADDRINT addr, ADDRINT sp, ADDRINT fp){
    if( calloc_size > threshold)
-     splay_tree_insert(tree, (splay_tree_key) addr, (splay_tree_value) addr+calloc_size);
+     splay_tree_insert(tree, (splay_tree_key) addr, (splay_tree_value) addr+calloc_size)->site = AllocSite(sp, fp);
 }
 
 static size_t realloc_size = 0;
@@ -182,11 +580,11 @@ VOID realloc_before(ADDRINT addr, size_t size){
 }
 
 //treat realloc as free + malloc
-VOID realloc_after(ADDRINT addr){
+VOID realloc_after(ADDRINT addr, ADDRINT sp, ADDRINT fp){
   if(addr > 0)
      splay_tree_remove(tree, realloc_addr); 
   if (realloc_size > threshold)
-     splay_tree_insert(tree, (splay_tree_key) addr, (splay_tree_value) addr+realloc_size);
+     splay_tree_insert(tree, (splay_tree_key) addr, (splay_tree_value) addr+realloc_size)->site = AllocSite(sp, fp);
 }
 
 static int posix_memalign_size=0;
@@ -216,8 +614,8 @@ VOID mmap_before(ADDRINT addr, size_t size){
    mmap_size = size;
 }
 
-VOID mmap_after(ADDRINT addr){ 
-    splay_tree_insert(tree,(splay_tree_key) addr,(splay_tree_value) addr+mmap_size);
+VOID mmap_after(ADDRINT addr, ADDRINT sp, ADDRINT fp){ 
+    splay_tree_insert(tree,(splay_tree_key) addr,(splay_tree_value) addr+mmap_size)->site = AllocSite(sp, fp);
 }
 
 static uintptr_t munmap_addr;
@@ -270,6 +668,8 @@ VOID RtnInsertCall(IMG img, CHAR *funcname){
         IPOINT_AFTER,
         (AFUNPTR)alloc_after,
         IARG_FUNCRET_EXITPOINT_VALUE,
+        IARG_REG_VALUE, REG_STACK_PTR,
+        IARG_REG_VALUE, REG_GBP,
         IARG_END);
     }
     else if (!strcmp(funcname, SBRK)){
@@ -307,6 +707,8 @@ VOID RtnInsertCall(IMG img, CHAR *funcname){
         IPOINT_AFTER,
         (AFUNPTR)calloc_after,
         IARG_FUNCRET_EXITPOINT_VALUE,
+        IARG_REG_VALUE, REG_STACK_PTR,
+        IARG_REG_VALUE, REG_GBP,
         IARG_END);
     }
     else if(!strcmp(funcname, REALLOC)) {
@@ -320,6 +722,8 @@ VOID RtnInsertCall(IMG img, CHAR *funcname){
         IPOINT_AFTER,
         (AFUNPTR)realloc_after,
         IARG_FUNCRET_EXITPOINT_VALUE,
+        IARG_REG_VALUE, REG_STACK_PTR,
+        IARG_REG_VALUE, REG_GBP,
         IARG_END);
    }
    else if(!strcmp(funcname, POSIX_MEMALIGN)) {
@@ -347,6 +751,8 @@ VOID RtnInsertCall(IMG img, CHAR *funcname){
         IPOINT_AFTER,
         (AFUNPTR)mmap_after,
         IARG_FUNCRET_EXITPOINT_VALUE,
+        IARG_REG_VALUE, REG_STACK_PTR,
+        IARG_REG_VALUE, REG_GBP,
         IARG_END);
    }
      else if(!strcmp(funcname, MUNMAP)) {
@@ -403,21 +809,108 @@ VOID InstrumentMalloc(IMG img, VOID * v ){
     RtnInsertCall(img, (CHAR*)POSIX_MEMALIGN);
 }
 
+//One shard per thread if the template contains the thread id
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v){
+  if (perThread)
+    PIN_SetThreadData(buf_key, OpenOutput(tid), tid);
+}
+
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v){
+  if (!perThread)
+    return;
+  PIN_GetLock(&fileLock, tid + 1);
+  CloseOutput(static_cast<Output *>(PIN_GetThreadData(buf_key, tid)));
+  PIN_ReleaseLock(&fileLock);
+}
+
+//Flush before fork, so the accesses buffered so far reach the files of the
+//parent. Other threads keep recording while the fork happens, which is why
+//the child still has to discard its copies of the streams unflushed.
+//The locks are held across the fork, so the child never inherits a lock
+//taken by a thread that does not exist in the child; both sides release them.
+VOID ForkBefore(THREADID tid, const CONTEXT *ctxt, VOID *v){
+  PIN_GetLock(&fileLock, tid + 1);
+  PIN_GetLock(&siteLock, tid + 1);
+  for (auto out : outputs)
+    if (out->traceFile)
+      fflush(out->traceFile);
+}
+
+VOID ForkParent(THREADID tid, const CONTEXT *ctxt, VOID *v){
+  PIN_ReleaseLock(&siteLock);
+  PIN_ReleaseLock(&fileLock);
+}
+
+//The child drops the shards and counters of its parent and writes its own
+VOID ForkChild(THREADID tid, const CONTEXT *ctxt, VOID *v){
+  forked = TRUE;
+  memset(stats, 0, sizeof(stats));
+  for (auto out : outputs) {
+    //Closing the descriptor first makes fclose() drop the buffer, which
+    //would otherwise be written into the trace of the parent again
+    if (out->traceFile) {
+      close(fileno(out->traceFile));
+      fclose(out->traceFile);
+    }
+    if (out->ring)
+      munmap(out->ring, MatRingSize(out->ring->capacity));
+    delete out;
+  }
+  outputs.clear();
+  PIN_ReleaseLock(&siteLock);
+  PIN_ReleaseLock(&fileLock);
+
+  if (perThread)
+    PIN_SetThreadData(buf_key, OpenOutput(tid), tid);
+  else
+    sharedOutput = OpenOutput(tid);
+}
+
+//Follow exec'd children (pin -follow_execv). The new image is traced with
+//the same options and an incremented exec count.
+//Rings stay open: the exec may still fail, and a consumer knows a ring is
+//done once the new image created its rings (see mat-ring.h).
+BOOL FollowChild(CHILD_PROCESS child, VOID *v){
+  PIN_GetLock(&fileLock, 1);
+  for (auto out : outputs)
+    if (out->open) {
+      if (out->traceFile)
+        fflush(out->traceFile);
+      WriteSourcelines(out);
+    }
+  PIN_ReleaseLock(&fileLock);
+  WriteSites();
+
+  std::vector<std::string> args;
+  for (size_t i = 0; i < pinArgs.size(); i++) {
+    if (pinArgs[i] == "-exec_seq") {
+      i++;
+      continue;
+    }
+    args.push_back(pinArgs[i]);
+  }
+  std::stringstream seq;
+  seq << KnobExecSeq.Value() + 1;
+  args.push_back("-exec_seq");
+  args.push_back(seq.str());
+  args.push_back("--");
+
+  std::vector<const CHAR *> childArgv;
+  for (auto &a : args)
+    childArgv.push_back(a.c_str());
+  CHILD_PROCESS_SetPinCommandLine(child, childArgv.size(), &childArgv[0]);
+  return TRUE;
+}
+
 //Write out some statistics at the finalization step
 VOID Fini(INT32 code, VOID *v)
 {
    PIN_GetLock(&fileLock, 1);
-
-   ipFile =fopen("sourcelines.txt","w");
-
-   for(auto it: sourcelines)
-       fprintf(ipFile, "%lu %s\n", it.first, it.second.c_str());
-   fflush(ipFile);
-   fclose(ipFile);
-   PIN_ReleaseLock(&fileLock);
-
-   fclose(traceFile);
+   for (auto out : outputs)
+     CloseOutput(out);
+   WriteStats("exit", TRUE);
    PIN_ReleaseLock(&fileLock);
+   WriteSites();
 }
 
 
@@ -425,7 +918,39 @@ int main(int argc, char *argv[])
 {
     PIN_Init(argc, argv);
 
-    traceFile = fopen("memtrace.txt", "w");
+    //Remember the Pin command line for exec'd children
+    for (int i = 0; i < argc && strcmp(argv[i], "--"); i++)
+      pinArgs.push_back(argv[i]);
+
+    PIN_InitLock(&fileLock);
+    PIN_InitLock(&siteLock);
+    buf_key = PIN_CreateThreadDataKey(0);
+
+    //The first traced process of an output directory holds mat.lock until it
+    //exits; every other process that runs meanwhile writes pid shards. The
+    //descriptor is inherited by forked and exec'd children on purpose.
+    int lock = open((KnobOutputDir.Value() + "/mat.lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock >= 0 && flock(lock, LOCK_EX | LOCK_NB) != 0) {
+      sharedDir = TRUE;
+      close(lock);
+    }
+
+    ringMode = !KnobRingDir.Value().empty();
+    if (ringMode)
+      mkdir(KnobRingDir.Value().c_str(), 0755);
+    if (KnobRingPolicy.Value() == "block")
+      ringPolicy = MAT_RING_BLOCK;
+    else if (KnobRingPolicy.Value() == "sample")
+      ringPolicy = MAT_RING_SAMPLE;
+    ringTimeout = KnobRingTimeout.Value();
+    ringSample = KnobRingSample.Value() ? KnobRingSample.Value() : 1;
+    statsCycles = KnobStatsCycles.Value();
+    siteDepth = KnobSiteDepth.Value() < MAX_SITE_DEPTH ? KnobSiteDepth.Value() : MAX_SITE_DEPTH;
+
+    //Rings have a single producer, so they are always per thread
+    perThread = ringMode || KnobShard.Value().find("%t") != std::string::npos;
+    if (!perThread)
+      sharedOutput = OpenOutput(0);
 
     PIN_InterceptSignal(SIGUSR1, SignalHandler1, 0);
     PIN_UnblockSignal(SIGUSR1, TRUE);
@@ -433,12 +958,21 @@ int main(int argc, char *argv[])
     PIN_InterceptSignal(SIGUSR2, SignalHandler2, 0);
     PIN_UnblockSignal(SIGUSR2, TRUE);
 
-    PIN_InitLock(&fileLock);
+    if (KnobStatsSignal.Value() > 0) {
+      PIN_InterceptSignal(KnobStatsSignal.Value(), StatsHandler, 0);
+      PIN_UnblockSignal(KnobStatsSignal.Value(), TRUE);
+    }
 
     IMG_AddInstrumentFunction(InstrumentMalloc, NULL);
     TRACE_AddInstrumentFunction(Trace, NULL);
     filter.Activate();
   
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
+    PIN_AddForkFunction(FPOINT_BEFORE, ForkBefore, 0);
+    PIN_AddForkFunction(FPOINT_AFTER_IN_PARENT, ForkParent, 0);
+    PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, ForkChild, 0);
+    PIN_AddFollowChildProcessFunction(FollowChild, 0);
     PIN_AddFiniFunction(Fini, 0);
 
     PIN_StartProgram();
@@ -0,0 +1,166 @@
+#include "distance.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+PackedNgram NgramPacker::Pack(const Ngram &g)
+{
+  PackedNgram p;
+  std::unordered_map<int64_t, int32_t> blocks;
+  for (auto &s : g.symbols) {
+    auto b = blocks.insert(std::make_pair(s.blockId, (int32_t) blocks.size()));
+    auto o = strides.insert(std::make_pair(s.stride, (int32_t) strides.size()));
+    p.block.push_back(b.first->second);
+    p.stride.push_back(o.first->second);
+    p.read.push_back(s.isRead ? 1 : 0);
+  }
+  p.blocks = blocks.size();
+  p.count = g.count;
+  return p;
+}
+
+double LengthBound(const PackedNgram &a, const PackedNgram &b)
+{
+  size_t n1 = a.block.size(), n2 = b.block.size();
+  size_t mx = std::max(n1, n2);
+  return mx ? (double) (mx - std::min(n1, n2)) / mx : 0.0;
+}
+
+//Sum of the position costs of two aligned n-grams. Returns as soon as the
+//sum reaches limit.
+static uint64_t AlignCost(const int32_t *b1, const int32_t *o1, const int32_t *r1,
+                          const int32_t *b2, const int32_t *o2, const int32_t *r2,
+                          size_t n, uint64_t limit)
+{
+  uint64_t cost = 0;
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i two = _mm_set1_epi32(2);
+  size_t vn = n & ~(size_t) 3;
+  while (i < vn) {
+    __m128i acc = _mm_setzero_si128();
+    size_t stop = std::min(vn, i + 64);
+    for (; i < stop; i += 4) {
+      __m128i eqR = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (r1 + i)), _mm_loadu_si128((const __m128i *) (r2 + i)));
+      __m128i eqB = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (b1 + i)), _mm_loadu_si128((const __m128i *) (b2 + i)));
+      __m128i eqO = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (o1 + i)), _mm_loadu_si128((const __m128i *) (o2 + i)));
+      __m128i mism = _mm_add_epi32(_mm_andnot_si128(eqB, one), _mm_andnot_si128(eqO, one));
+      acc = _mm_add_epi32(acc, _mm_or_si128(_mm_and_si128(eqR, mism), _mm_andnot_si128(eqR, two)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    cost += (uint32_t) _mm_cvtsi128_si32(acc);
+    if (cost >= limit)
+      return cost;
+  }
+#endif
+  for (; i < n; i++) {
+    if (r1[i] != r2[i])
+      cost += 2;
+    else
+      cost += (b1[i] != b2[i]) + (o1[i] != o2[i]);
+  }
+  return cost;
+}
+
+double NgramDistance(const PackedNgram &x, const PackedNgram &y, double limit, std::vector<int32_t> &scratch)
+{
+  //the n-gram with more distinct blocks keeps its block IDs
+  const PackedNgram &a = x.blocks >= y.blocks ? x : y;
+  const PackedNgram &b = x.blocks >= y.blocks ? y : x;
+  size_t n1 = a.block.size(), n2 = b.block.size();
+  size_t mx = std::max(n1, n2), mn = std::min(n1, n2);
+  if (mx == 0)
+    return 0.0;
+
+  //positions without a counterpart always cost 2
+  uint64_t denom = 2 * mx;
+  uint64_t fixed = 2 * (mx - mn);
+  uint64_t best = denom + 1;
+  if (limit * denom < best)
+    best = (uint64_t) ceil(limit * denom);
+  if (fixed >= best)
+    return limit;
+
+  size_t shifts = n1 > n2 ? n1 - n2 + 1 : 1;
+  scratch.resize(n2);
+  for (int32_t r = 0; r < std::max(a.blocks, 1); r++) {
+    for (size_t j = 0; j < n2; j++)
+      scratch[j] = (b.block[j] + r) % a.blocks;
+    for (size_t s = 0; s < shifts; s++) {
+      uint64_t cost = fixed + AlignCost(&a.block[s], &a.stride[s], &a.read[s],
+                                        &scratch[0], &b.stride[0], &b.read[0], mn, best - fixed);
+      if (cost < best)
+        best = cost;
+      if (best == fixed)
+        return (double) best / denom;
+    }
+  }
+  if (best > denom || (double) best >= limit * denom)
+    return limit;
+  return (double) best / denom;
+}
+
+//For every n-gram of a find the closest n-gram of b. Candidates are visited
+//in order of their length bound, which stops the search once no remaining
+//candidate can beat the best distance found so far.
+void Nearest(const std::vector<PackedNgram> &a, const std::vector<PackedNgram> &b, bool aFirst,
+             unsigned threads, std::vector<std::pair<size_t, double> > &nearest)
+{
+  threads = std::max(threads, 1u);
+  nearest.assign(a.size(), std::make_pair((size_t) -1, 1.0));
+  std::vector<std::vector<int32_t> > scratch(threads);
+  std::vector<std::vector<std::pair<double, size_t> > > order(threads);
+  ParallelFor(a.size(), threads, [&](uint64_t i, unsigned t) {
+    std::vector<std::pair<double, size_t> > &o = order[t];
+    o.clear();
+    for (size_t j = 0; j < b.size(); j++)
+      o.push_back(std::make_pair(LengthBound(a[i], b[j]), j));
+    std::sort(o.begin(), o.end());
+    double best = 1.0;
+    size_t arg = o.empty() ? (size_t) -1 : o[0].second;
+    for (auto &c : o) {
+      if (c.first >= best)
+        break;
+      //ties are resolved as distance.py does for the first argument
+      double d = aFirst ? NgramDistance(a[i], b[c.second], best, scratch[t])
+                        : NgramDistance(b[c.second], a[i], best, scratch[t]);
+      if (d < best) {
+        best = d;
+        arg = c.second;
+      }
+    }
+    nearest[i] = std::make_pair(arg, best);
+  });
+}
+
+static double WeightedMean(const std::vector<PackedNgram> &a, const std::vector<std::pair<size_t, double> > &nearest)
+{
+  double sum = 0, weight = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    sum += a[i].count * nearest[i].second;
+    weight += a[i].count;
+  }
+  return weight > 0 ? sum / weight : 0.0;
+}
+
+double TraceDistance(const std::vector<PackedNgram> &a, const std::vector<PackedNgram> &b, unsigned threads,
+                     std::vector<std::pair<size_t, double> > *ab, std::vector<std::pair<size_t, double> > *ba)
+{
+  threads = std::max(threads, 1u);
+  std::vector<std::pair<size_t, double> > nab, nba;
+  Nearest(a, b, true, threads, nab);
+  Nearest(b, a, false, threads, nba);
+  //An empty table (e.g. of a failed run) is as far from everything as it gets
+  double d = a.empty() || b.empty() ? 1.0 : (WeightedMean(a, nab) + WeightedMean(b, nba)) / 2;
+  if (ab)
+    ab->swap(nab);
+  if (ba)
+    ba->swap(nba);
+  return d;
+}
@@ -0,0 +1,52 @@
+//Modified Levenshtein distance between n-grams as computed by mix() in
+//distance.py: the block IDs of the n-gram with fewer distinct blocks are
+//mapped onto the blocks of the other one (all rotations of the mapping are
+//tried), the shorter n-gram is shifted along the longer one and every
+//position costs 2 for a read/write mismatch, otherwise 1 for a block and 1
+//for a stride mismatch. The result is normalized to [0, 1].
+
+#ifndef MAT_DISTANCE_H
+#define MAT_DISTANCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "ngram.h"
+
+//N-gram packed into integer columns for the distance kernel
+struct PackedNgram {
+  std::vector<int32_t> block;    //renumbered in order of first appearance
+  std::vector<int32_t> stride;   //index into the stride dictionary
+  std::vector<int32_t> read;
+  int32_t blocks;                //number of distinct blocks
+  uint64_t count;
+};
+
+class NgramPacker {
+ public:
+  PackedNgram Pack(const Ngram &g);
+
+ private:
+  std::unordered_map<int64_t, int32_t> strides;
+};
+
+//Lower bound of NgramDistance() given by the lengths alone
+double LengthBound(const PackedNgram &a, const PackedNgram &b);
+
+//Distance of a and b. Stops early and returns limit as soon as it is clear
+//that the distance cannot be smaller than limit.
+double NgramDistance(const PackedNgram &a, const PackedNgram &b, double limit, std::vector<int32_t> &scratch);
+
+//For every n-gram of a the index and distance of the closest n-gram of b.
+//aFirst decides which side is passed first when both have as many blocks.
+void Nearest(const std::vector<PackedNgram> &a, const std::vector<PackedNgram> &b, bool aFirst,
+             unsigned threads, std::vector<std::pair<size_t, double> > &nearest);
+
+//Distance of two traces: mean of the nearest n-gram distances in both
+//directions, weighted by the n-gram counts; 1 if either side has no n-grams
+double TraceDistance(const std::vector<PackedNgram> &a, const std::vector<PackedNgram> &b, unsigned threads,
+                     std::vector<std::pair<size_t, double> > *ab = 0, std::vector<std::pair<size_t, double> > *ba = 0);
+
+#endif
@@ -1,4 +1,5 @@
 import numpy
+import os
 import pydot
 import sys
 import matplotlib.pyplot as plt
@@ -14,14 +15,24 @@ class Graph(object):
       self.tree        = {}
       self.edges       = {}
       self.graph       = None
-      # read output of PIN tool
-      data             = self.prepare_input() # postprocess output file. Compute strides and assign blockIDs.
-      self.ips	       = data[:,0]
-      self.blockIds    = data[:,7]
-      self.strides     = data[:,8]
-      self.objectSizes = data[:,6]
-      self.isRead      = data[:,4]
-      self.total       = data.shape[0]
+      if os.path.isdir(filename):
+        # columns written by mat-export are mapped, not read
+        column           = lambda name: numpy.load(os.path.join(filename, name + ".npy"), mmap_mode="r")
+        self.ips         = column("ip")
+        self.blockIds    = column("blockid")
+        self.strides     = column("stride")
+        self.objectSizes = column("blocksize")
+        self.isRead      = column("type")
+        self.total       = self.ips.shape[0]
+      else:
+        # read output of PIN tool
+        data             = self.prepare_input() # postprocess output file. Compute strides and assign blockIDs.
+        self.ips         = data[:,0]
+        self.blockIds    = data[:,7]
+        self.strides     = data[:,8]
+        self.objectSizes = data[:,6]
+        self.isRead      = data[:,4]
+        self.total       = data.shape[0]
       self.sourcelines = {}
 
       # Read sourcelines for ip
@@ -266,7 +277,11 @@ class Graph(object):
 
       data = numpy.loadtxt(self.filename, dtype=numpy.int64)
 
-      if data.shape[1] < 8:
+      if data.shape[1] < 9:
+        # traces of the PIN tool with -site_depth carry the allocation site
+        # of every block, which is used as block ID; blocks without a site
+        # (site 0) keep their rank
+        sites         = data[:,7] if data.shape[1] == 8 else None
         block_ids     = numpy.zeros(data.shape[0])
         stride        = numpy.zeros(data.shape[0])
         unique_blocks = numpy.unique(data[:,3])
@@ -280,7 +295,7 @@ class Graph(object):
           inds = numpy.where(data[:,3] == i)
 
           #assign each memory block a specific ID
-          block_ids[inds] = counter
+          block_ids[inds] = counter if sites is None else numpy.where(sites[inds] != 0, sites[inds], counter)
 
           #compute the delta offsets
           n  = len(inds[0])
@@ -295,8 +310,12 @@ class Graph(object):
 
         stride.shape = (stride.shape[0],1)
         block_ids.shape = (block_ids.shape[0], 1)
-        data = numpy.hstack([data, block_ids , stride])
-        numpy.savetxt(self.filename, data, fmt="%d %d %d %d %d %d %d %d %d")
+        data = numpy.hstack([data[:,0:7], block_ids , stride])
+        if sites is None:
+          numpy.savetxt(self.filename, data, fmt="%d %d %d %d %d %d %d %d %d")
+        else:
+          # keep the sites as 10th column, so readers know the block IDs are sites
+          numpy.savetxt(self.filename, numpy.hstack([data, sites.reshape(-1, 1)]), fmt="%d %d %d %d %d %d %d %d %d %d")
 
       return data 
    
@@ -0,0 +1,343 @@
+#include "graph.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "replay.h"
+#include "trace.h"
+
+void GraphBuilder::Begin(uint64_t first)
+{
+  current.first = first;
+  current.n = 0;
+}
+
+uint32_t GraphBuilder::Add(const NodeKey &key, bool isRead)
+{
+  uint64_t pos = current.first + current.n;
+  auto it = ids.insert(std::make_pair(key, (uint32_t) nodes.size()));
+  uint32_t id = it.first->second;
+  if (it.second) {
+    GraphNode node = { key, 1, pos, isRead };
+    nodes.push_back(node);
+  } else {
+    GraphNode &node = nodes[id];
+    node.count++;
+    if (pos < node.first) {
+      node.first = pos;
+      node.isRead = isRead;
+    }
+  }
+
+  if (current.n >= 2) {
+    Triple t = { current.tail[0], current.tail[1], id };
+    auto e = triples.insert(std::make_pair(t, EdgeStat()));
+    if (e.second) {
+      e.first->second.count = 1;
+      e.first->second.first = pos;
+    } else {
+      e.first->second.count++;
+      if (pos < e.first->second.first)
+        e.first->second.first = pos;
+    }
+  }
+  if (current.n < 2)
+    current.head[current.n] = id;
+  current.tail[0] = current.tail[1];
+  current.tail[1] = id;
+  current.n++;
+  return id;
+}
+
+void GraphBuilder::End()
+{
+  if (current.n > 0)
+    segments.push_back(current);
+}
+
+Graph::Graph() : total(0)
+{
+  tail[0] = RootParent;
+  tail[1] = Root;
+  GraphNode root = { { 0, 0, 0 }, 1, 0, false };
+  nodes.push_back(root);
+  nodes.push_back(root);
+}
+
+bool Graph::Build(Trace &trace)
+{
+  GraphAnalysis analysis;
+  TraceReplay replay;
+  replay.Register(&analysis);
+  replay.Run(trace);
+  *this = std::move(analysis.graph);
+  return true;
+}
+
+void Graph::Merge(std::vector<GraphBuilder> &builders)
+{
+  std::unordered_map<NodeKey, uint32_t, NodeKeyHash> ids;
+  for (size_t i = 2; i < nodes.size(); i++)
+    ids[nodes[i].key] = i;
+  std::unordered_map<Triple, GraphBuilder::EdgeStat, TripleHash> triples;
+  for (auto &e : edges) {
+    Triple t = { e.grandparent, e.parent, e.node };
+    GraphBuilder::EdgeStat s = { e.count, e.first };
+    triples[t] = s;
+  }
+
+  //Merge node tables
+  std::vector<std::vector<uint32_t> > remap(builders.size());
+  for (size_t b = 0; b < builders.size(); b++) {
+    for (auto &n : builders[b].nodes) {
+      auto it = ids.insert(std::make_pair(n.key, (uint32_t) nodes.size()));
+      if (it.second) {
+        nodes.push_back(n);
+      } else {
+        GraphNode &node = nodes[it.first->second];
+        node.count += n.count;
+        if (n.first < node.first) {
+          node.first = n.first;
+          node.isRead = n.isRead;
+        }
+      }
+      remap[b].push_back(it.first->second);
+      total += n.count;
+    }
+  }
+
+  auto addTriple = [&](const Triple &t, uint64_t count, uint64_t first) {
+    auto e = triples.insert(std::make_pair(t, GraphBuilder::EdgeStat()));
+    if (e.second) {
+      e.first->second.count = count;
+      e.first->second.first = first;
+    } else {
+      e.first->second.count += count;
+      if (first < e.first->second.first)
+        e.first->second.first = first;
+    }
+  };
+
+  for (size_t b = 0; b < builders.size(); b++)
+    for (auto &it : builders[b].triples) {
+      Triple t = { remap[b][it.first.grandparent], remap[b][it.first.parent], remap[b][it.first.node] };
+      addTriple(t, it.second.count, it.second.first);
+    }
+
+  //Stitch segments: the first two records of a segment follow the last
+  //records of the previous segment, the trace starts at RootParent -> Root
+  std::vector<std::pair<uint64_t, std::pair<size_t, size_t> > > order;
+  for (size_t b = 0; b < builders.size(); b++)
+    for (size_t s = 0; s < builders[b].segments.size(); s++)
+      order.push_back(std::make_pair(builders[b].segments[s].first, std::make_pair(b, s)));
+  std::sort(order.begin(), order.end());
+
+  uint32_t prev[2] = { tail[0], tail[1] };
+  for (auto &o : order) {
+    size_t b = o.second.first;
+    const GraphBuilder::Segment &s = builders[b].segments[o.second.second];
+    for (uint64_t j = 0; j < s.n && j < 2; j++) {
+      uint32_t id = remap[b][s.head[j]];
+      Triple t = { prev[0], prev[1], id };
+      addTriple(t, 1, s.first + j);
+      prev[0] = prev[1];
+      prev[1] = id;
+    }
+    if (s.n > 2) {
+      prev[0] = remap[b][s.tail[0]];
+      prev[1] = remap[b][s.tail[1]];
+    }
+  }
+
+  for (auto &b : builders)
+    b = GraphBuilder();
+
+  //Number nodes and edges by first occurrence, as create_graph() does
+  std::vector<uint32_t> order2(nodes.size() - 2);
+  for (size_t i = 0; i < order2.size(); i++)
+    order2[i] = i + 2;
+  std::sort(order2.begin(), order2.end(), [&](uint32_t a, uint32_t b) {
+    return nodes[a].first < nodes[b].first;
+  });
+  std::vector<uint32_t> ren(nodes.size());
+  std::vector<GraphNode> sorted(nodes.begin(), nodes.begin() + 2);
+  ren[RootParent] = RootParent;
+  ren[Root] = Root;
+  for (auto i : order2) {
+    ren[i] = sorted.size();
+    sorted.push_back(nodes[i]);
+  }
+  nodes.swap(sorted);
+  tail[0] = ren[prev[0]];
+  tail[1] = ren[prev[1]];
+
+  edges.clear();
+  for (auto &it : triples) {
+    GraphEdge e = { ren[it.first.grandparent], ren[it.first.parent], ren[it.first.node], it.second.count, it.second.first };
+    edges.push_back(e);
+  }
+  std::sort(edges.begin(), edges.end(), [](const GraphEdge &a, const GraphEdge &b) {
+    return a.first < b.first;
+  });
+}
+
+void Graph::Add(const Graph &other)
+{
+  std::unordered_map<NodeKey, uint32_t, NodeKeyHash> ids;
+  for (size_t i = 2; i < nodes.size(); i++)
+    ids[nodes[i].key] = i;
+
+  uint64_t offset = total;
+  std::vector<uint32_t> remap(other.nodes.size());
+  remap[RootParent] = RootParent;
+  remap[Root] = Root;
+  for (size_t i = 2; i < other.nodes.size(); i++) {
+    GraphNode n = other.nodes[i];
+    n.first += offset;
+    auto it = ids.insert(std::make_pair(n.key, (uint32_t) nodes.size()));
+    if (it.second)
+      nodes.push_back(n);
+    else
+      nodes[it.first->second].count += n.count;
+    remap[i] = it.first->second;
+  }
+  total += other.total;
+
+  std::unordered_map<Triple, size_t, TripleHash> index;
+  for (size_t i = 0; i < edges.size(); i++) {
+    Triple t = { edges[i].grandparent, edges[i].parent, edges[i].node };
+    index[t] = i;
+  }
+  for (auto e : other.edges) {
+    e.grandparent = remap[e.grandparent];
+    e.parent = remap[e.parent];
+    e.node = remap[e.node];
+    e.first += offset;
+    Triple t = { e.grandparent, e.parent, e.node };
+    auto it = index.insert(std::make_pair(t, edges.size()));
+    if (it.second)
+      edges.push_back(e);
+    else
+      edges[it.first->second].count += e.count;
+  }
+}
+
+static std::string NodeName(const GraphNode &n)
+{
+  char buf[96];
+  snprintf(buf, sizeof(buf), "%" PRId64 "_%" PRId64 "_%" PRIu64, n.key.blockId, n.key.stride, n.key.size);
+  return buf;
+}
+
+//Quote node IDs the same way pydot does
+static std::string DotId(const std::string &s)
+{
+  bool alnum = !s.empty() && !isdigit((unsigned char) s[0]);
+  for (char c : s)
+    if (!isalnum((unsigned char) c) && c != '_')
+      alnum = false;
+  return alnum ? s : "\"" + s + "\"";
+}
+
+bool Graph::WriteDot(const char *filename) const
+{
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+
+  //pydot writes nodes and edges in the order they were added: a new node is
+  //followed by the edge from its parent, a new parent adds another edge
+  std::map<std::pair<uint32_t, uint32_t>, uint64_t> pairs;
+  for (auto &e : edges) {
+    auto it = pairs.insert(std::make_pair(std::make_pair(e.parent, e.node), e.first));
+    if (e.first < it.first->second)
+      it.first->second = e.first;
+  }
+  std::vector<std::pair<std::pair<uint64_t, int>, std::pair<uint32_t, uint32_t> > > items;
+  for (size_t i = 2; i < nodes.size(); i++)
+    items.push_back(std::make_pair(std::make_pair(nodes[i].first, 0), std::make_pair(0u, (uint32_t) i)));
+  for (auto &p : pairs)
+    items.push_back(std::make_pair(std::make_pair(p.second, 1), p.first));
+  std::sort(items.begin(), items.end());
+
+  fprintf(f, "digraph G {\n");
+  for (auto &it : items) {
+    if (it.first.second == 0) {
+      const GraphNode &n = nodes[it.second.second];
+      std::string name = NodeName(n);
+      fprintf(f, "%s [label=\"%s - %" PRIu64 "\"", DotId(name).c_str(), name.c_str(), n.count);
+      if (n.count > 0.001 * total)
+        fprintf(f, ", fontsize=24");
+      if (!n.isRead)
+        fprintf(f, ", style=\"filled, bold\"");
+      fprintf(f, "];\n");
+    } else {
+      uint32_t parent = it.second.first;
+      std::string from = parent == Root ? "Root" : DotId(NodeName(nodes[parent]));
+      fprintf(f, "%s -> %s;\n", from.c_str(), DotId(NodeName(nodes[it.second.second])).c_str());
+    }
+  }
+  fprintf(f, "}\n");
+  return fclose(f) == 0;
+}
+
+bool Graph::WriteJson(const char *filename) const
+{
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  fprintf(f, "{\"total\": %" PRIu64 ",\n \"nodes\": [", total);
+  for (size_t i = 2; i < nodes.size(); i++) {
+    const GraphNode &n = nodes[i];
+    fprintf(f, "%s\n  {\"id\": %zu, \"block\": %" PRId64 ", \"stride\": %" PRId64 ", \"size\": %" PRIu64
+               ", \"count\": %" PRIu64 ", \"isRead\": %d}",
+            i == 2 ? "" : ",", i, n.key.blockId, n.key.stride, n.key.size, n.count, n.isRead ? 1 : 0);
+  }
+  fprintf(f, "],\n \"edges\": [");
+  for (size_t i = 0; i < edges.size(); i++) {
+    const GraphEdge &e = edges[i];
+    fprintf(f, "%s\n  {\"grandparent\": %u, \"parent\": %u, \"node\": %u, \"count\": %" PRIu64 "}",
+            i == 0 ? "" : ",", e.grandparent, e.parent, e.node, e.count);
+  }
+  fprintf(f, "]}\n");
+  return fclose(f) == 0;
+}
+
+bool Graph::ReadJson(const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  nodes.resize(2);
+  edges.clear();
+  total = 0;
+  //WriteJson() puts every node on a line of its own
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    GraphNode n;
+    unsigned id;
+    int isRead;
+    if (sscanf(line, " {\"id\": %u, \"block\": %" SCNd64 ", \"stride\": %" SCNd64 ", \"size\": %" SCNu64
+                     ", \"count\": %" SCNu64 ", \"isRead\": %d}",
+               &id, &n.key.blockId, &n.key.stride, &n.key.size, &n.count, &isRead) != 6)
+      continue;
+    n.first = nodes.size();
+    n.isRead = isRead != 0;
+    nodes.push_back(n);
+  }
+  fclose(f);
+  for (size_t i = 2; i < nodes.size(); i++)
+    total += nodes[i].count;
+  return true;
+}
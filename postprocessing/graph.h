@@ -0,0 +1,111 @@
+//Memory graph as built by generate_graph.py create_graph(): every node is a
+//(blockId, stride, size) tuple, every edge counts how often a node was
+//reached from a parent node which itself followed a grandparent node.
+
+#ifndef MAT_GRAPH_H
+#define MAT_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+class Trace;
+
+struct NodeKey {
+  int64_t blockId;
+  int64_t stride;
+  uint64_t size;
+  bool operator==(const NodeKey &o) const { return blockId == o.blockId && stride == o.stride && size == o.size; }
+};
+
+struct NodeKeyHash {
+  size_t operator()(const NodeKey &k) const {
+    uint64_t h = (uint64_t) k.blockId * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t) k.stride + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    h ^= k.size + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+struct GraphNode {
+  NodeKey key;
+  uint64_t count;
+  uint64_t first;      //trace position of the first access
+  bool isRead;         //access type of the first access
+};
+
+struct GraphEdge {
+  uint32_t grandparent;
+  uint32_t parent;
+  uint32_t node;
+  uint64_t count;
+  uint64_t first;
+};
+
+struct Triple {
+  uint32_t grandparent, parent, node;
+  bool operator==(const Triple &o) const { return grandparent == o.grandparent && parent == o.parent && node == o.node; }
+};
+
+struct TripleHash {
+  size_t operator()(const Triple &t) const {
+    uint64_t h = ((uint64_t) t.grandparent << 32 | t.parent) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (t.node + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2));
+  }
+};
+
+//Counts nodes and triples of consecutive records. Every worker owns one
+//builder; triples crossing the border of a segment are added by Graph.
+class GraphBuilder {
+ public:
+  void Begin(uint64_t first);
+  uint32_t Add(const NodeKey &key, bool isRead);
+  void End();
+
+ private:
+  friend class Graph;
+  struct EdgeStat { uint64_t count; uint64_t first; };
+  struct Segment { uint64_t first; uint64_t n; uint32_t head[2]; uint32_t tail[2]; };
+
+  std::unordered_map<NodeKey, uint32_t, NodeKeyHash> ids;
+  std::vector<GraphNode> nodes;
+  std::unordered_map<Triple, EdgeStat, TripleHash> triples;
+  std::vector<Segment> segments;
+  Segment current;
+};
+
+class Graph {
+ public:
+  static const uint32_t RootParent = 0;
+  static const uint32_t Root = 1;
+
+  Graph();
+
+  //Build the graph from a prepared trace, the same as running a
+  //GraphAnalysis (replay.h) over it
+  bool Build(Trace &trace);
+
+  //Merge the builders; segments are stitched together in trace order. The
+  //first segment follows the last one of the previous Merge(), so a stream
+  //can be merged piece by piece.
+  void Merge(std::vector<GraphBuilder> &builders);
+
+  //Add the nodes and edges of a graph built from another trace. Positions
+  //of the other graph are moved behind the ones of this graph.
+  void Add(const Graph &other);
+
+  bool WriteDot(const char *filename) const;
+  bool WriteJson(const char *filename) const;
+
+  //Read the nodes written by WriteJson(); edges are not restored
+  bool ReadJson(const char *filename);
+
+  //Node 0 and 1 are the "RootParent" and "Root" placeholders
+  std::vector<GraphNode> nodes;
+  std::vector<GraphEdge> edges;
+  uint64_t total;
+  uint32_t tail[2];    //last two nodes merged
+};
+
+#endif
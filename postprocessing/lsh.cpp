@@ -0,0 +1,312 @@
+#include "lsh.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+static const unsigned Buckets = 4096;
+
+static inline uint64_t Mix(uint64_t x)
+{
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+MinHash::MinHash(unsigned hashes) : values(hashes, UINT64_MAX) {}
+
+void MinHash::Add(uint64_t x)
+{
+  for (size_t i = 0; i < values.size(); i++) {
+    uint64_t h = Mix(x ^ Mix(i + 1));
+    if (h < values[i])
+      values[i] = h;
+  }
+}
+
+void MinHash::Add(const NgramTable &table)
+{
+  for (auto &g : table.ngrams) {
+    std::unordered_map<int64_t, int64_t> blocks;
+    uint64_t h = 0x6E6772616DULL;
+    for (auto s : g.symbols) {
+      s.blockId = blocks.insert(std::make_pair(s.blockId, (int64_t) blocks.size())).first->second;
+      h = Mix(h ^ SymbolCode(s));
+    }
+    Add(h);
+  }
+}
+
+void MinHash::Add(const Graph &graph)
+{
+  for (size_t i = 2; i < graph.nodes.size(); i++) {
+    const GraphNode &n = graph.nodes[i];
+    NgramSymbol s = { n.key.blockId, n.key.stride, n.key.size, n.isRead };
+    Add(SymbolCode(s) ^ 0x6E6F6465ULL);
+  }
+}
+
+double MinHash::Similarity(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b)
+{
+  size_t n = std::min(a.size(), b.size()), same = 0;
+  for (size_t i = 0; i < n; i++)
+    same += a[i] == b[i];
+  return n ? (double) same / n : 0.0;
+}
+
+LshIndex::LshIndex() : hashes(0), bands(0) {}
+
+static bool MakeDir(const std::string &path)
+{
+  if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+    perror(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool ValidShape(unsigned hashes, unsigned bands)
+{
+  return bands > 0 && hashes > 0 && hashes % bands == 0;
+}
+
+bool LshIndex::Open(const char *d, unsigned h, unsigned b)
+{
+  dir = d;
+  std::string conf = dir + "/index.conf";
+  if (access(conf.c_str(), F_OK) == 0) {
+    if (!LoadConfig())
+      return false;
+    if ((h && h != hashes) || (b && b != bands)) {
+      fprintf(stderr, "%s: index has %u hashes and %u bands\n", dir.c_str(), hashes, bands);
+      return false;
+    }
+  } else {
+    //Check the shape before anything is created
+    hashes = h ? h : 128;
+    bands = b ? b : 32;
+    if (!ValidShape(hashes, bands)) {
+      fprintf(stderr, "invalid index shape: %u hashes, %u bands (hashes must be a multiple of bands)\n", hashes, bands);
+      return false;
+    }
+    if (!MakeDir(dir))
+      return false;
+    FILE *f = fopen(conf.c_str(), "w");
+    if (!f) {
+      perror(conf.c_str());
+      return false;
+    }
+    fprintf(f, "hashes %u bands %u\n", hashes, bands);
+    if (fclose(f) != 0) {
+      perror(conf.c_str());
+      return false;
+    }
+  }
+  return MakeDir(dir + "/tables") && MakeDir(dir + "/bands") && LoadRuns();
+}
+
+bool LshIndex::Open(const char *d)
+{
+  dir = d;
+  return LoadConfig() && LoadRuns();
+}
+
+bool LshIndex::LoadConfig()
+{
+  std::string conf = dir + "/index.conf";
+  FILE *f = fopen(conf.c_str(), "r");
+  if (!f) {
+    perror(conf.c_str());
+    return false;
+  }
+  if (fscanf(f, "hashes %u bands %u", &hashes, &bands) != 2)
+    hashes = bands = 0;
+  fclose(f);
+  if (!ValidShape(hashes, bands)) {
+    fprintf(stderr, "%s: invalid index configuration\n", conf.c_str());
+    return false;
+  }
+  return true;
+}
+
+//Runs are indexed by their id; ids of failed additions stay unnamed
+bool LshIndex::LoadRuns()
+{
+  names.clear();
+  FILE *f = fopen((dir + "/runs.txt").c_str(), "r");
+  if (!f)
+    return true;
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned id;
+    char *name = strchr(line, ' ');
+    if (!name || sscanf(line, "%u", &id) != 1)
+      continue;
+    name[strcspn(name, "\n")] = 0;
+    if (id >= names.size())
+      names.resize(id + 1);
+    names[id] = name + 1;
+  }
+  fclose(f);
+  return true;
+}
+
+uint64_t LshIndex::BandHash(const std::vector<uint64_t> &sketch, unsigned band) const
+{
+  unsigned rows = hashes / bands;
+  uint64_t h = Mix(band + 1);
+  for (unsigned r = 0; r < rows; r++)
+    h = Mix(h ^ sketch[band * rows + r]);
+  return h;
+}
+
+std::string LshIndex::Bucket(unsigned band, uint64_t hash) const
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/bands/%u/%03x", band, (unsigned) (hash % Buckets));
+  return dir + buf;
+}
+
+static bool CopyFile(const char *from, const std::string &to)
+{
+  FILE *in = fopen(from, "rb");
+  if (!in) {
+    perror(from);
+    return false;
+  }
+  FILE *out = fopen(to.c_str(), "wb");
+  if (!out) {
+    perror(to.c_str());
+    fclose(in);
+    return false;
+  }
+  char buf[1 << 16];
+  size_t n;
+  bool ok = true;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    ok = ok && fwrite(buf, 1, n, out) == n;
+  fclose(in);
+  return fclose(out) == 0 && ok;
+}
+
+bool LshIndex::Add(const std::string &name, const std::vector<uint64_t> &sketch, const char *table, unsigned &id)
+{
+  if (sketch.size() != hashes) {
+    fprintf(stderr, "sketch has %zu hashes, index expects %u\n", sketch.size(), hashes);
+    return false;
+  }
+
+  //Serialize concurrent additions to the same index
+  std::string lockName = dir + "/lock";
+  int lock = open(lockName.c_str(), O_RDWR | O_CREAT, 0644);
+  if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+    perror(lockName.c_str());
+    if (lock >= 0)
+      close(lock);
+    return false;
+  }
+  //Take the id from the counter in next and advance it before anything is
+  //written, so buckets left behind by a failed addition never refer to a
+  //later run
+  bool ok = LoadRuns();
+  std::string nextName = dir + "/next";
+  FILE *f = fopen(nextName.c_str(), "r");
+  id = names.size();
+  if (f) {
+    unsigned next;
+    if (fscanf(f, "%u", &next) == 1 && next > id)
+      id = next;
+    fclose(f);
+  }
+  f = ok ? fopen(nextName.c_str(), "w") : 0;
+  if (f) {
+    fprintf(f, "%u\n", id + 1);
+    ok = fclose(f) == 0;
+  } else {
+    ok = false;
+  }
+
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/tables/%u.ngrams", id);
+  ok = ok && CopyFile(table, dir + buf);
+
+  int fd = open((dir + "/sketches.bin").c_str(), O_WRONLY | O_CREAT, 0644);
+  size_t bytes = hashes * sizeof(uint64_t);
+  ok = ok && fd >= 0 && pwrite(fd, &sketch[0], bytes, (off_t) id * bytes) == (ssize_t) bytes;
+  if (fd >= 0)
+    close(fd);
+
+  for (unsigned b = 0; ok && b < bands; b++) {
+    snprintf(buf, sizeof(buf), "/bands/%u", b);
+    uint64_t entry[2] = { BandHash(sketch, b), id };
+    FILE *f = MakeDir(dir + buf) ? fopen(Bucket(b, entry[0]).c_str(), "ab") : 0;
+    ok = f && fwrite(entry, sizeof(entry), 1, f) == 1;
+    if (f)
+      ok = fclose(f) == 0 && ok;
+  }
+
+  //The run becomes visible once it is listed in runs.txt
+  f = ok ? fopen((dir + "/runs.txt").c_str(), "a") : 0;
+  if (f) {
+    fprintf(f, "%u %s\n", id, name.c_str());
+    ok = fclose(f) == 0;
+    if (id >= names.size())
+      names.resize(id + 1);
+    names[id] = name;
+  } else {
+    ok = false;
+  }
+  if (!ok)
+    fprintf(stderr, "%s: could not add %s\n", dir.c_str(), name.c_str());
+  close(lock);
+  return ok;
+}
+
+bool LshIndex::Candidates(const std::vector<uint64_t> &sketch, std::vector<unsigned> &ids) const
+{
+  ids.clear();
+  for (unsigned b = 0; b < bands; b++) {
+    uint64_t h = BandHash(sketch, b);
+    FILE *f = fopen(Bucket(b, h).c_str(), "rb");
+    if (!f)
+      continue;
+    uint64_t entry[2];
+    while (fread(entry, sizeof(entry), 1, f) == 1)
+      if (entry[0] == h && entry[1] < names.size() && !names[entry[1]].empty())
+        ids.push_back(entry[1]);
+    fclose(f);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return true;
+}
+
+bool LshIndex::Sketch(unsigned id, std::vector<uint64_t> &sketch) const
+{
+  int fd = open((dir + "/sketches.bin").c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  sketch.resize(hashes);
+  size_t bytes = hashes * sizeof(uint64_t);
+  bool ok = pread(fd, &sketch[0], bytes, (off_t) id * bytes) == (ssize_t) bytes;
+  close(fd);
+  return ok;
+}
+
+std::string LshIndex::Name(unsigned id) const
+{
+  return id < names.size() ? names[id] : std::string();
+}
+
+std::string LshIndex::Table(unsigned id) const
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/tables/%u.ngrams", id);
+  return dir + buf;
+}
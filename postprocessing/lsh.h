@@ -0,0 +1,74 @@
+//MinHash sketches of traced runs and an on-disk locality-sensitive hashing
+//index over them. A sketch summarizes the set of n-grams and graph nodes of
+//a run; the sketch is cut into bands and every band is hashed into a bucket
+//file. Runs sharing a bucket with a query are the candidates for the exact
+//n-gram distance.
+//
+//Index layout:
+//  index.conf          hashes and bands of the sketches
+//  runs.txt            one line per run: id name
+//  next                next run id, never reused
+//  sketches.bin        sketches of all runs, hashes * 8 bytes each
+//  tables/<id>.ngrams  copy of the n-gram table of the run
+//  bands/<b>/<bucket>  pairs of (band hash, run id)
+
+#ifndef MAT_LSH_H
+#define MAT_LSH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+#include "ngram.h"
+
+class MinHash {
+ public:
+  explicit MinHash(unsigned hashes);
+
+  void Add(uint64_t x);
+  //N-grams are hashed with their blocks renumbered by first appearance, so
+  //the same access pattern on differently numbered blocks matches
+  void Add(const NgramTable &table);
+  void Add(const Graph &graph);
+
+  //Estimated Jaccard similarity of two sketches
+  static double Similarity(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b);
+
+  std::vector<uint64_t> values;
+};
+
+class LshIndex {
+ public:
+  LshIndex();
+
+  //Open an index directory, a new index is created with the given shape.
+  //0 takes the shape of an existing index or 128 hashes and 32 bands; other
+  //values must match the shape of an existing index.
+  bool Open(const char *dir, unsigned hashes, unsigned bands);
+  //Open an existing index for queries, without creating anything
+  bool Open(const char *dir);
+
+  bool Add(const std::string &name, const std::vector<uint64_t> &sketch, const char *table, unsigned &id);
+
+  //IDs of runs sharing at least one band with the sketch
+  bool Candidates(const std::vector<uint64_t> &sketch, std::vector<unsigned> &ids) const;
+
+  bool Sketch(unsigned id, std::vector<uint64_t> &sketch) const;
+  std::string Name(unsigned id) const;
+  std::string Table(unsigned id) const;
+
+  unsigned hashes;
+  unsigned bands;
+
+ private:
+  uint64_t BandHash(const std::vector<uint64_t> &sketch, unsigned band) const;
+  std::string Bucket(unsigned band, uint64_t hash) const;
+  bool LoadConfig();
+  bool LoadRuns();
+
+  std::string dir;
+  std::vector<std::string> names;
+};
+
+#endif
@@ -0,0 +1,86 @@
+//Native replacement for distance.py. With one n-gram table the distance
+//matrix of its n-grams is written (one row per line, as plotted by
+//distance.py). With two tables every n-gram is matched with its nearest
+//n-gram of the other table, and the count weighted mean of these distances
+//is printed as the distance of the two traces.
+//
+//Usage: mat-distance [-t threads] [-n max] [-o out] a.ngrams [b.ngrams]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "distance.h"
+#include "parallel.h"
+#include "trace.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-distance [-t threads] [-n max] [-o out] a.ngrams [b.ngrams]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  size_t max = 0;
+  const char *outFile = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:o:")) != -1) {
+    switch (opt) {
+      case 't': threads = std::max(1, atoi(optarg)); break;
+      case 'n': max = strtoull(optarg, 0, 10); break;
+      case 'o': outFile = optarg; break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc && optind + 2 != argc)
+    Usage();
+
+  std::string out = outFile ? outFile : std::string(argv[optind]) + ".dist";
+
+  NgramPacker packer;
+  std::vector<PackedNgram> sets[2];
+  int nsets = argc - optind;
+  for (int s = 0; s < nsets; s++) {
+    NgramTable table;
+    if (!table.Read(argv[optind + s]))
+      return 1;
+    if (max && table.ngrams.size() > max)
+      table.ngrams.resize(max);
+    for (auto &g : table.ngrams)
+      sets[s].push_back(packer.Pack(g));
+  }
+
+  FILE *f = fopen(out.c_str(), "w");
+  if (!f) {
+    perror(out.c_str());
+    return 1;
+  }
+
+  if (nsets == 1) {
+    const std::vector<PackedNgram> &a = sets[0];
+    size_t n = a.size();
+    std::vector<double> matrix(n * n, 0.0);
+    std::vector<std::vector<int32_t> > scratch(threads);
+    ParallelFor(n, threads, [&](uint64_t i, unsigned t) {
+      for (size_t j = 0; j < n; j++)
+        if (i != j)
+          matrix[i * n + j] = NgramDistance(a[i], a[j], 1.0, scratch[t]);
+    });
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        fprintf(f, "%.4f%c", matrix[i * n + j], j + 1 == n ? '\n' : ' ');
+  } else {
+    std::vector<std::pair<size_t, double> > ab, ba;
+    double d = TraceDistance(sets[0], sets[1], threads, &ab, &ba);
+    for (size_t i = 0; i < ab.size(); i++)
+      fprintf(f, "a %zu %ld %.4f\n", i, (long) ab[i].first, ab[i].second);
+    for (size_t j = 0; j < ba.size(); j++)
+      fprintf(f, "b %zu %ld %.4f\n", j, (long) ba[j].first, ba[j].second);
+    printf("distance %.4f\n", d);
+  }
+  return fclose(f) == 0 ? 0 : 1;
+}
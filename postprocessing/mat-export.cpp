@@ -0,0 +1,205 @@
+//Converts traces into numpy column files, so the Python scripts can
+//numpy.load(..., mmap_mode="r") only the fields they need instead of
+//parsing the text trace. Every field is written into <dir>/<field>.npy:
+//
+//  ip, ea, block, blocksize   uint64
+//  offset, blockid, stride    int64
+//  size                       uint32   size of the access
+//  type                       uint8    1 for reads, 0 for writes
+//  thread                     uint32   index of the shard in shards.txt
+//  node                       uint32   row of the access' node in nodes.npy
+//
+//plus the memory graph as tables nodes.npy (block, stride, size, count,
+//first, isRead; rows 0 and 1 are the RootParent and Root placeholders) and
+//edges.npy (grandparent, parent, node, count, first). Several shards are
+//exported one after the other, with block IDs and graph as in mat-merge.
+//
+//Usage: mat-export [-t threads] [-w window] [-o dir] memtrace.txt [memtrace.*.txt ...]
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "graph.h"
+#include "npy.h"
+#include "parallel.h"
+#include "trace.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-export [-t threads] [-w window] [-o dir] memtrace.txt [memtrace.*.txt ...]\n");
+  exit(1);
+}
+
+struct Column {
+  const char *name;
+  const char *descr;
+  size_t width;
+};
+
+enum { IP, EA, OFFSET, BLOCK, BLOCKID, STRIDE, SIZE, TYPE, BLOCKSIZE, THREAD, NODE, COLUMNS };
+
+static const Column columns[COLUMNS] = {
+  { "ip",        "'<u8'", 8 },
+  { "ea",        "'<u8'", 8 },
+  { "offset",    "'<i8'", 8 },
+  { "block",     "'<u8'", 8 },
+  { "blockid",   "'<i8'", 8 },
+  { "stride",    "'<i8'", 8 },
+  { "size",      "'<u4'", 4 },
+  { "type",      "'|u1'", 1 },
+  { "blocksize", "'<u8'", 8 },
+  { "thread",    "'<u4'", 4 },
+  { "node",      "'<u4'", 4 },
+};
+
+struct NodeRow { int64_t block; int64_t stride; uint64_t size; uint64_t count; uint64_t first; uint64_t isRead; };
+struct EdgeRow { uint64_t grandparent; uint64_t parent; uint64_t node; uint64_t count; uint64_t first; };
+
+static bool WriteTables(const std::string &dir, const Graph &graph)
+{
+  NpyFile nodes, edges;
+  if (!nodes.Create(dir + "/nodes.npy", "[('block', '<i8'), ('stride', '<i8'), ('size', '<u8'), ('count', '<u8'), "
+                                        "('first', '<u8'), ('isRead', '<u8')]",
+                    sizeof(NodeRow), graph.nodes.size()))
+    return false;
+  NodeRow *n = nodes.Rows<NodeRow>();
+  for (size_t i = 0; i < graph.nodes.size(); i++) {
+    const GraphNode &g = graph.nodes[i];
+    NodeRow row = { g.key.blockId, g.key.stride, g.key.size, g.count, g.first, g.isRead };
+    n[i] = row;
+  }
+
+  if (!edges.Create(dir + "/edges.npy", "[('grandparent', '<u8'), ('parent', '<u8'), ('node', '<u8'), ('count', '<u8'), "
+                                        "('first', '<u8')]",
+                    sizeof(EdgeRow), graph.edges.size()))
+    return false;
+  EdgeRow *e = edges.Rows<EdgeRow>();
+  for (size_t i = 0; i < graph.edges.size(); i++) {
+    const GraphEdge &g = graph.edges[i];
+    EdgeRow row = { g.grandparent, g.parent, g.node, g.count, g.first };
+    e[i] = row;
+  }
+  return nodes.Close() && edges.Close();
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  uint64_t window = 1 << 20;
+  std::string dir = "memtrace.npy.d";
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:o:")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'w': window = strtoull(optarg, 0, 10); break;
+      case 'o': dir = optarg; break;
+      default: Usage();
+    }
+  }
+  size_t shards = argc - optind;
+  if (shards == 0)
+    Usage();
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    perror(dir.c_str());
+    return 1;
+  }
+
+  unsigned chunks = std::max(1u, (unsigned) (threads / shards));
+  std::vector<Trace> traces(shards);
+  std::vector<char> ok(shards, 0);
+  ParallelFor(shards, threads, [&](uint64_t i, unsigned) {
+    ok[i] = traces[i].Open(argv[optind + i]);
+    if (ok[i])
+      traces[i].Prepare(chunks, window);
+  });
+  if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+    return 1;
+
+  std::vector<uint64_t> starts;
+  for (auto &t : traces) {
+    std::vector<uint64_t> s = t.BlockStarts();
+    starts.insert(starts.end(), s.begin(), s.end());
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+  //First pass: the graph, so every access can refer to its node
+  std::vector<Graph> graphs(shards);
+  ParallelFor(shards, threads, [&](uint64_t i, unsigned) {
+    traces[i].RankBlocks(starts);
+    graphs[i].Build(traces[i]);
+  });
+  Graph graph;
+  for (auto &g : graphs)
+    graph.Add(g);
+  graphs.clear();
+  std::unordered_map<NodeKey, uint32_t, NodeKeyHash> ids;
+  for (size_t i = 2; i < graph.nodes.size(); i++)
+    ids[graph.nodes[i].key] = i;
+
+  std::vector<uint64_t> first(shards + 1, 0);
+  for (size_t i = 0; i < shards; i++)
+    first[i + 1] = first[i] + traces[i].Records();
+
+  NpyFile files[COLUMNS];
+  for (int c = 0; c < COLUMNS; c++)
+    if (!files[c].Create(dir + "/" + columns[c].name + ".npy", columns[c].descr, columns[c].width, first[shards]))
+      return 1;
+  uint64_t *ip = files[IP].Rows<uint64_t>();
+  uint64_t *ea = files[EA].Rows<uint64_t>();
+  int64_t *offset = files[OFFSET].Rows<int64_t>();
+  uint64_t *block = files[BLOCK].Rows<uint64_t>();
+  int64_t *blockId = files[BLOCKID].Rows<int64_t>();
+  int64_t *stride = files[STRIDE].Rows<int64_t>();
+  uint32_t *size = files[SIZE].Rows<uint32_t>();
+  uint8_t *type = files[TYPE].Rows<uint8_t>();
+  uint64_t *blockSize = files[BLOCKSIZE].Rows<uint64_t>();
+  uint32_t *thread = files[THREAD].Rows<uint32_t>();
+  uint32_t *node = files[NODE].Rows<uint32_t>();
+
+  //Second pass: every window fills its own rows of the columns
+  ParallelFor(shards, threads, [&](uint64_t s, unsigned) {
+    traces[s].ForEachWindow([&](TraceWindow &w) {
+      uint64_t row = first[s] + w.first;
+      for (auto &r : w.records) {
+        NodeKey key = { r.blockId, r.stride, r.blockSize };
+        ip[row] = r.ip;
+        ea[row] = r.ea;
+        offset[row] = r.offset;
+        block[row] = r.block;
+        blockId[row] = r.blockId;
+        stride[row] = r.stride;
+        size[row] = r.size;
+        type[row] = r.isRead;
+        blockSize[row] = r.blockSize;
+        thread[row] = s;
+        node[row] = ids.at(key);
+        row++;
+      }
+    });
+  });
+  for (int c = 0; c < COLUMNS; c++)
+    if (!files[c].Close())
+      return 1;
+
+  if (!WriteTables(dir, graph))
+    return 1;
+
+  std::string list = dir + "/shards.txt";
+  FILE *f = fopen(list.c_str(), "w");
+  if (!f) {
+    perror(list.c_str());
+    return 1;
+  }
+  for (size_t i = 0; i < shards; i++)
+    fprintf(f, "%zu %" PRIu64 " %s\n", i, first[i], argv[optind + i]);
+  fclose(f);
+  return 0;
+}
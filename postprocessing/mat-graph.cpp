@@ -0,0 +1,58 @@
+//Native replacement for Graph.prepare_input() and Graph.create_graph() in
+//generate_graph.py. Builds the memory graph from the output of the PIN tool:
+//each node is a (blockId, stride, size) tuple and each edge counts how often
+//a node followed its parent and grandparent node.
+//
+//Usage: mat-graph [-t threads] [-w window] [-d out.dot] [-j out.json] memtrace.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "replay.h"
+#include "trace.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-graph [-t threads] [-w window] [-d out.dot] [-j out.json] memtrace.txt\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  uint64_t window = 1 << 20;
+  const char *dotFile = 0;
+  const char *jsonFile = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:d:j:")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'w': window = strtoull(optarg, 0, 10); break;
+      case 'd': dotFile = optarg; break;
+      case 'j': jsonFile = optarg; break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc)
+    Usage();
+
+  std::string dot = dotFile ? dotFile : std::string(argv[optind]) + ".dot";
+
+  Trace trace;
+  if (!trace.Open(argv[optind]))
+    return 1;
+  trace.Prepare(threads, window);
+
+  GraphAnalysis graph;
+  TraceReplay replay;
+  replay.Register(&graph);
+  replay.Run(trace);
+
+  if (!graph.graph.WriteDot(dot.c_str()))
+    return 1;
+  if (jsonFile && !graph.graph.WriteJson(jsonFile))
+    return 1;
+  return 0;
+}
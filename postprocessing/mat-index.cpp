@@ -0,0 +1,122 @@
+//Similarity index over many traced runs. "add" stores the MinHash sketch of
+//a run's n-gram table (and optionally its graph nodes) in an LSH index;
+//"query" returns the k most similar runs of the index. Only runs sharing an
+//LSH bucket with the query are compared with the exact n-gram distance.
+//
+//Usage: mat-index add [-g graph.json] [-s hashes] [-b bands] index name run.ngrams
+//       mat-index query [-g graph.json] [-k top] [-c candidates] [-t threads] index run.ngrams
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "distance.h"
+#include "lsh.h"
+#include "trace.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-index add [-g graph.json] [-s hashes] [-b bands] index name run.ngrams\n"
+                  "       mat-index query [-g graph.json] [-k top] [-c candidates] [-t threads] index run.ngrams\n");
+  exit(1);
+}
+
+static bool MakeSketch(const char *tableFile, const char *graphFile, NgramTable &table, MinHash &sketch)
+{
+  if (!table.Read(tableFile))
+    return false;
+  sketch.Add(table);
+  if (graphFile) {
+    Graph graph;
+    if (!graph.ReadJson(graphFile))
+      return false;
+    sketch.Add(graph);
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+    Usage();
+  bool add = !strcmp(argv[1], "add");
+  if (!add && strcmp(argv[1], "query"))
+    Usage();
+
+  const char *graphFile = 0;
+  unsigned hashes = 0, bands = 0, top = 5, maxCandidates = 64;
+  unsigned threads = DefaultThreads();
+  int opt;
+  optind = 2;
+  while ((opt = getopt(argc, argv, "g:s:b:k:c:t:")) != -1) {
+    switch (opt) {
+      case 'g': graphFile = optarg; break;
+      case 's': hashes = atoi(optarg); if (!hashes) Usage(); break;
+      case 'b': bands = atoi(optarg); if (!bands) Usage(); break;
+      case 'k': top = atoi(optarg); break;
+      case 'c': maxCandidates = atoi(optarg); break;
+      case 't': threads = atoi(optarg); break;
+      default: Usage();
+    }
+  }
+  if (argc - optind != (add ? 3 : 2))
+    Usage();
+
+  LshIndex index;
+  if (add ? !index.Open(argv[optind], hashes, bands) : !index.Open(argv[optind]))
+    return 1;
+  const char *tableFile = argv[argc - 1];
+
+  NgramTable table;
+  MinHash sketch(index.hashes);
+  if (!MakeSketch(tableFile, graphFile, table, sketch))
+    return 1;
+
+  if (add) {
+    unsigned id;
+    if (!index.Add(argv[optind + 1], sketch.values, tableFile, id))
+      return 1;
+    printf("%u %s\n", id, argv[optind + 1]);
+    return 0;
+  }
+
+  //Rank the candidates by their estimated similarity, then by exact distance
+  std::vector<unsigned> ids;
+  index.Candidates(sketch.values, ids);
+  std::vector<std::pair<double, unsigned> > estimated;
+  std::vector<uint64_t> other;
+  for (auto id : ids)
+    if (index.Sketch(id, other))
+      estimated.push_back(std::make_pair(-MinHash::Similarity(sketch.values, other), id));
+  std::sort(estimated.begin(), estimated.end());
+  if (estimated.size() > maxCandidates)
+    estimated.resize(maxCandidates);
+
+  NgramPacker packer;
+  std::vector<PackedNgram> query;
+  for (auto &g : table.ngrams)
+    query.push_back(packer.Pack(g));
+
+  std::vector<std::pair<double, std::pair<double, unsigned> > > results;
+  for (auto &e : estimated) {
+    NgramTable t;
+    if (!t.Read(index.Table(e.second).c_str()))
+      continue;
+    std::vector<PackedNgram> run;
+    for (auto &g : t.ngrams)
+      run.push_back(packer.Pack(g));
+    double d = TraceDistance(query, run, threads);
+    results.push_back(std::make_pair(d, std::make_pair(-e.first, e.second)));
+  }
+  std::sort(results.begin(), results.end());
+  if (results.size() > top)
+    results.resize(top);
+
+  //name, exact distance, estimated Jaccard similarity
+  for (auto &r : results)
+    printf("%s %.4f %.4f\n", index.Name(r.second.second).c_str(), r.first, r.second.first);
+  return 0;
+}
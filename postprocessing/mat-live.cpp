@@ -0,0 +1,244 @@
+//Reference consumer of the shared memory rings written by the PIN tool with
+//-ring_dir (see mat-ring.h). Picks up the rings of all traced threads and
+//processes, builds the memory graph and an access heatmap while the program
+//runs and rewrites both every interval seconds.
+//
+//Block IDs are assigned in order of first appearance and the stride of an
+//access is its offset minus the offset of the previous access to the same
+//block, because later accesses are not known yet.
+//
+//Usage: mat-live [-i seconds] [-b bins] [-d out.dot] [-m heatmap.txt] [-f] ring_dir
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../mat-ring.h"
+#include "graph.h"
+#include "replay.h"
+
+static_assert(sizeof(MatRingHeader) == MAT_RING_HEADER_SIZE, "ring header layout");
+static_assert(sizeof(MatRingRecord) == 48, "ring record layout");
+
+struct Ring {
+  std::string path;
+  unsigned pid;
+  unsigned exec;
+  MatRingHeader *header;
+  size_t size;
+  uint64_t records;
+  uint64_t dropped;
+  uint64_t skipped;
+  bool done;
+  GraphBuilder builder;   //records since the last snapshot
+  Graph graph;            //records up to the last snapshot
+  std::unordered_map<uint64_t, uint64_t> lastOffset;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void Stop(int)
+{
+  stop = 1;
+}
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-live [-i seconds] [-b bins] [-d out.dot] [-m heatmap.txt] [-f] ring_dir\n");
+  exit(1);
+}
+
+//Map a ring once the tool has initialized it
+static bool OpenRing(const std::string &path, Ring &ring)
+{
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < MAT_RING_HEADER_SIZE) {
+    close(fd);
+    return false;
+  }
+  void *m = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    return false;
+  MatRingHeader *h = (MatRingHeader *) m;
+  if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != MAT_RING_MAGIC || h->version != MAT_RING_VERSION ||
+      h->recordSize != sizeof(MatRingRecord) || MatRingSize(h->capacity) > (uint64_t) st.st_size) {
+    munmap(m, st.st_size);
+    return false;
+  }
+  const char *name = strrchr(path.c_str(), '/');
+  unsigned tid;
+  if (sscanf(name ? name + 1 : path.c_str(), "mat.%u.%u.%u.ring", &ring.pid, &ring.exec, &tid) != 3) {
+    munmap(m, st.st_size);
+    return false;
+  }
+  ring.path = path;
+  ring.header = h;
+  ring.size = st.st_size;
+  ring.records = ring.dropped = ring.skipped = 0;
+  ring.done = false;
+  return true;
+}
+
+static void Scan(const std::string &dir, std::set<std::string> &known, std::vector<Ring *> &rings)
+{
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (struct dirent *e = readdir(d)) {
+    size_t n = strlen(e->d_name);
+    if (strncmp(e->d_name, "mat.", 4) || n < 5 || strcmp(e->d_name + n - 5, ".ring"))
+      continue;
+    std::string path = dir + "/" + e->d_name;
+    if (known.count(path))
+      continue;
+    Ring *ring = new Ring;
+    if (OpenRing(path, *ring)) {
+      known.insert(path);
+      rings.push_back(ring);
+    } else {
+      delete ring;
+    }
+  }
+  closedir(d);
+}
+
+int main(int argc, char *argv[])
+{
+  double interval = 5;
+  unsigned bins = 64;
+  const char *dotFile = "live.dot";
+  const char *heatFile = "live.heatmap";
+  bool follow = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "i:b:d:m:f")) != -1) {
+    switch (opt) {
+      case 'i': interval = atof(optarg); break;
+      case 'b': bins = atoi(optarg); break;
+      case 'd': dotFile = optarg; break;
+      case 'm': heatFile = optarg; break;
+      case 'f': follow = true; break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc || bins == 0)
+    Usage();
+  std::string dir = argv[optind];
+
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+
+  std::set<std::string> known;
+  std::vector<Ring *> rings;
+  std::unordered_map<uint64_t, int64_t> blockIds;
+  HeatmapAnalysis heatmap(bins);
+  heatmap.Begin(1);
+  std::vector<MatRingRecord> batch(1 << 16);
+  TraceWindow window;
+  window.chunk = 0;
+
+  time_t last = time(0);
+  bool finished = false;
+  while (!finished) {
+    finished = stop;
+    Scan(dir, known, rings);
+
+    //The exec count of the current image of every process
+    std::unordered_map<unsigned, unsigned> image;
+    for (auto ring : rings) {
+      auto it = image.insert(std::make_pair(ring->pid, ring->exec)).first;
+      it->second = std::max(it->second, ring->exec);
+    }
+
+    uint64_t processed = 0;
+    for (auto ring : rings) {
+      if (ring->done)
+        continue;
+      MatRingHeader *h = ring->header;
+      //Rings of an image replaced by exec are complete, like closed ones
+      bool closed = __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE) || image[ring->pid] > ring->exec;
+      uint64_t n = MatRingPop(h, &batch[0], batch.size());
+      ring->builder.Begin(ring->records);
+      window.first = ring->records;
+      window.records.resize(n);
+      for (uint64_t i = 0; i < n; i++) {
+        const MatRingRecord &r = batch[i];
+        int64_t id = blockIds.insert(std::make_pair(r.block, (int64_t) blockIds.size())).first->second;
+        auto prev = ring->lastOffset.insert(std::make_pair(r.block, r.offset));
+        int64_t stride = (int64_t) (r.offset - prev.first->second);
+        prev.first->second = r.offset;
+        NodeKey key = { id, stride, r.blockSize };
+        ring->builder.Add(key, r.isRead != 0);
+
+        TraceRecord rec = { r.ip, r.ea, (int64_t) r.offset, r.block, r.size, r.isRead != 0, r.blockSize, id, stride, -1 };
+        window.records[i] = rec;
+      }
+      ring->builder.End();
+      heatmap.Window(window);
+      ring->records += n;
+      ring->dropped = h->dropped;
+      ring->skipped = h->skipped;
+      processed += n;
+
+      //Everything written before closed was set has been read now
+      if (closed && n == 0) {
+        ring->done = true;
+        munmap(ring->header, ring->size);
+        ring->header = 0;
+        unlink(ring->path.c_str());
+      }
+    }
+
+    bool active = false;
+    for (auto ring : rings)
+      active = active || !ring->done;
+    if (!follow && !rings.empty() && !active)
+      finished = true;
+
+    if (finished || difftime(time(0), last) >= interval) {
+      last = time(0);
+      Graph graph;
+      uint64_t dropped = 0, skipped = 0, records = 0;
+      for (auto ring : rings) {
+        //Only the records since the last snapshot are merged
+        std::vector<GraphBuilder> builders(1);
+        std::swap(builders[0], ring->builder);
+        ring->graph.Merge(builders);
+        graph.Add(ring->graph);
+        records += ring->records;
+        dropped += ring->dropped;
+        skipped += ring->skipped;
+      }
+      graph.WriteDot(dotFile);
+      heatmap.End();
+      heatmap.Write(heatFile);
+      fprintf(stderr, "rings %zu records %lu dropped %lu skipped %lu nodes %zu\n", rings.size(),
+              (unsigned long) records, (unsigned long) dropped, (unsigned long) skipped, graph.nodes.size() - 2);
+    }
+
+    if (processed == 0 && !finished)
+      usleep(1000);
+  }
+
+  for (auto ring : rings) {
+    if (ring->header)
+      munmap(ring->header, ring->size);
+    delete ring;
+  }
+  return 0;
+}
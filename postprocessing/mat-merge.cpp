@@ -0,0 +1,78 @@
+//Combine the trace shards written with -shard (one per process and/or
+//thread) into one memory graph. Every shard is an access stream of its own
+//that starts at the Root node; block IDs are assigned over the block start
+//addresses of all shards, so accesses of different threads to the same
+//allocation end up in the same node. Node and edge counters are summed.
+//
+//Usage: mat-merge [-t threads] [-d out.dot] [-j out.json] memtrace.*.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "graph.h"
+#include "parallel.h"
+#include "trace.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-merge [-t threads] [-d out.dot] [-j out.json] memtrace.*.txt\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  const char *dotFile = "memtrace.dot";
+  const char *jsonFile = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:d:j:")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'd': dotFile = optarg; break;
+      case 'j': jsonFile = optarg; break;
+      default: Usage();
+    }
+  }
+  size_t shards = argc - optind;
+  if (shards == 0)
+    Usage();
+
+  //Shards are processed in parallel, large shards get several chunks
+  unsigned chunks = std::max(1u, (unsigned) (threads / shards));
+  std::vector<Trace> traces(shards);
+  std::vector<char> ok(shards, 0);
+  ParallelFor(shards, threads, [&](uint64_t i, unsigned) {
+    ok[i] = traces[i].Open(argv[optind + i]);
+    if (ok[i])
+      traces[i].Prepare(chunks);
+  });
+  if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+    return 1;
+
+  std::vector<uint64_t> starts;
+  for (auto &t : traces) {
+    std::vector<uint64_t> s = t.BlockStarts();
+    starts.insert(starts.end(), s.begin(), s.end());
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+  std::vector<Graph> graphs(shards);
+  ParallelFor(shards, threads, [&](uint64_t i, unsigned) {
+    traces[i].RankBlocks(starts);
+    graphs[i].Build(traces[i]);
+  });
+
+  Graph graph;
+  for (auto &g : graphs)
+    graph.Add(g);
+
+  if (!graph.WriteDot(dotFile))
+    return 1;
+  if (jsonFile && !graph.WriteJson(jsonFile))
+    return 1;
+  return 0;
+}
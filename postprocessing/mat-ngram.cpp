@@ -0,0 +1,66 @@
+//Native n-gram miner replacing Graph.get_ngrams() in generate_graph.py.
+//Counts the n-grams of graph nodes of the given lengths in one pass over the
+//trace and writes them into a single table, most frequent first. As in
+//get_ngrams() only n-grams seen in more than ratio * total accesses are kept.
+//
+//Usage: mat-ngram [-t threads] [-w window] [-l 2,4,8] [-r ratio] [-o out.ngrams] memtrace.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "trace.h"
+#include "replay.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-ngram [-t threads] [-w window] [-l 2,4,8] [-r ratio] [-o out.ngrams] memtrace.txt\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  uint64_t window = 1 << 20;
+  std::vector<unsigned> lengths;
+  double ratio = 0.01;
+  const char *outFile = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:l:r:o:")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'w': window = strtoull(optarg, 0, 10); break;
+      case 'l':
+        for (char *s = strtok(optarg, ","); s; s = strtok(0, ","))
+          if (atoi(s) > 0)
+            lengths.push_back(atoi(s));
+        break;
+      case 'r': ratio = atof(optarg); break;
+      case 'o': outFile = optarg; break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc)
+    Usage();
+  if (lengths.empty()) {
+    lengths.push_back(2);
+    lengths.push_back(4);
+    lengths.push_back(8);
+  }
+
+  std::string out = outFile ? outFile : std::string(argv[optind]) + ".ngrams";
+
+  Trace trace;
+  if (!trace.Open(argv[optind]))
+    return 1;
+  trace.Prepare(threads, window);
+
+  TraceReplay replay;
+  NgramAnalysis ngrams(lengths, ratio);
+  replay.Register(&ngrams);
+  replay.Run(trace);
+
+  return ngrams.table.Write(out.c_str()) ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+//Splits the trace into intervals of a fixed number of accesses and groups
+//them into phases (e.g. setup, solve, I/O) by their access signatures, see
+//phase.h. Writes the phases and the phase of every interval into
+//prefix.phases and the memory graph of every phase into prefix.phase<p>.dot.
+//The representative interval of a phase is a good candidate to trace alone
+//in later runs.
+//
+//Usage: mat-phase [-t threads] [-w window] [-n interval] [-s dims] [-r threshold] [-k phases] [-o prefix] [-j] memtrace.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "trace.h"
+#include "phase.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-phase [-t threads] [-w window] [-n interval] [-s dims] [-r threshold] [-k phases] "
+                  "[-o prefix] [-j] memtrace.txt\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  uint64_t window = 1 << 20;
+  uint64_t interval = 1000000;
+  unsigned dims = 32;
+  double threshold = 0.5;
+  unsigned maxPhases = 16;
+  const char *prefix = 0;
+  bool json = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:n:s:r:k:o:j")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'w': window = strtoull(optarg, 0, 10); break;
+      case 'n': interval = strtoull(optarg, 0, 10); break;
+      case 's': dims = atoi(optarg); break;
+      case 'r': threshold = atof(optarg); break;
+      case 'k': maxPhases = atoi(optarg); break;
+      case 'o': prefix = optarg; break;
+      case 'j': json = true; break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc || interval == 0 || dims == 0 || maxPhases == 0)
+    Usage();
+
+  std::string base = prefix ? prefix : argv[optind];
+
+  Trace trace;
+  if (!trace.Open(argv[optind]))
+    return 1;
+  trace.Prepare(threads, window);
+
+  Phases phases;
+  IntervalSignatures(trace, interval, dims, phases);
+  ClusterPhases(threshold, maxPhases, phases);
+  if (!phases.Write((base + ".phases").c_str()))
+    return 1;
+
+  std::vector<Graph> graphs;
+  BuildPhaseGraphs(trace, phases, graphs);
+  for (size_t p = 0; p < graphs.size(); p++) {
+    std::string name = base + ".phase" + std::to_string(p);
+    if (!graphs[p].WriteDot((name + ".dot").c_str()))
+      return 1;
+    if (json && !graphs[p].WriteJson((name + ".json").c_str()))
+      return 1;
+  }
+  printf("%zu intervals, %zu phases\n", phases.sequence.size(), phases.phases.size());
+  return 0;
+}
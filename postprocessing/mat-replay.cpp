@@ -0,0 +1,92 @@
+//Runs the memory graph, n-gram and heatmap analyses in a single pass over
+//the trace instead of one pass per tool (see replay.h). Only the analyses
+//whose output is requested are registered. The outputs are the same as
+//the ones of mat-graph and mat-ngram.
+//
+//Usage: mat-replay [-t threads] [-w window] [-d out.dot] [-j out.json] [-n out.ngrams [-l 2,4,8] [-r ratio]]
+//                  [-m out.heatmap [-b bins]] memtrace.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <memory>
+
+#include "replay.h"
+#include "trace.h"
+
+static void Usage()
+{
+  fprintf(stderr, "usage: mat-replay [-t threads] [-w window] [-d out.dot] [-j out.json] [-n out.ngrams [-l 2,4,8] [-r ratio]]\n"
+                  "                  [-m out.heatmap [-b bins]] memtrace.txt\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned threads = DefaultThreads();
+  uint64_t window = 1 << 20;
+  const char *dotFile = 0, *jsonFile = 0, *ngramFile = 0, *heatFile = 0;
+  std::vector<unsigned> lengths;
+  double ratio = 0.01;
+  unsigned bins = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:d:j:n:l:r:m:b:")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'w': window = strtoull(optarg, 0, 10); break;
+      case 'd': dotFile = optarg; break;
+      case 'j': jsonFile = optarg; break;
+      case 'n': ngramFile = optarg; break;
+      case 'l':
+        for (char *s = strtok(optarg, ","); s; s = strtok(0, ","))
+          if (atoi(s) > 0)
+            lengths.push_back(atoi(s));
+        break;
+      case 'r': ratio = atof(optarg); break;
+      case 'm': heatFile = optarg; break;
+      case 'b': bins = atoi(optarg); break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc || !(dotFile || jsonFile || ngramFile || heatFile))
+    Usage();
+  if (lengths.empty()) {
+    lengths.push_back(2);
+    lengths.push_back(4);
+    lengths.push_back(8);
+  }
+
+  Trace trace;
+  if (!trace.Open(argv[optind]))
+    return 1;
+  trace.Prepare(threads, window);
+
+  TraceReplay replay;
+  std::unique_ptr<GraphAnalysis> graph;
+  std::unique_ptr<NgramAnalysis> ngrams;
+  std::unique_ptr<HeatmapAnalysis> heatmap;
+  if (dotFile || jsonFile) {
+    graph.reset(new GraphAnalysis);
+    replay.Register(graph.get());
+  }
+  if (ngramFile) {
+    ngrams.reset(new NgramAnalysis(lengths, ratio));
+    replay.Register(ngrams.get());
+  }
+  if (heatFile) {
+    heatmap.reset(new HeatmapAnalysis(bins));
+    replay.Register(heatmap.get());
+  }
+  replay.Run(trace);
+
+  if (dotFile && !graph->graph.WriteDot(dotFile))
+    return 1;
+  if (jsonFile && !graph->graph.WriteJson(jsonFile))
+    return 1;
+  if (ngramFile && !ngrams->table.Write(ngramFile))
+    return 1;
+  if (heatFile && !heatmap->Write(heatFile))
+    return 1;
+  return 0;
+}
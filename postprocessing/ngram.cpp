@@ -0,0 +1,236 @@
+#include "ngram.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <algorithm>
+
+static const uint64_t Base = 0x100000001B3ULL;
+
+uint64_t SymbolCode(const NgramSymbol &s)
+{
+  //splitmix64 finalizer over the node key and access type
+  uint64_t x = (uint64_t) s.blockId * 0x9E3779B97F4A7C15ULL;
+  x ^= (uint64_t) s.stride + 0x632BE59BD9B4E019ULL + (x << 6) + (x >> 2);
+  x ^= s.size + 0x85157AF5ULL + (x << 6) + (x >> 2);
+  x ^= s.isRead ? 0xD6E8FEB86659FD93ULL : 0;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t HashSymbols(const NgramSymbol *s, unsigned n)
+{
+  uint64_t h = 0;
+  for (unsigned i = 0; i < n; i++)
+    h = h * Base + SymbolCode(s[i]);
+  return h;
+}
+
+NgramCounter::NgramCounter(const std::vector<unsigned> &l) : lengths(l), maxLength(0)
+{
+  //A length given twice would count its n-grams twice
+  std::sort(lengths.begin(), lengths.end());
+  lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+  for (auto n : lengths) {
+    uint64_t p = 1;
+    for (unsigned i = 0; i < n; i++)
+      p *= Base;
+    powers.push_back(p);
+    maxLength = std::max(maxLength, n);
+  }
+  ring.resize(maxLength + 1);
+  hashes.resize(lengths.size());
+}
+
+void NgramCounter::Begin(uint64_t first)
+{
+  current.first = first;
+  current.n = 0;
+  current.head.clear();
+  current.tail.clear();
+  std::fill(hashes.begin(), hashes.end(), 0);
+}
+
+void NgramCounter::Count(unsigned length, uint64_t hash, uint64_t first, const NgramSymbol *symbols, unsigned size, unsigned start)
+{
+  Key key = { hash, length };
+  auto range = entries.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    Entry &e = it->second;
+    unsigned i = 0;
+    while (i < length && pool[e.symbols + i] == symbols[(start + i) % size])
+      i++;
+    if (i < length)
+      continue;
+    e.count++;
+    if (first < e.first)
+      e.first = first;
+    return;
+  }
+  Entry e = { 1, first, pool.size() };
+  for (unsigned i = 0; i < length; i++)
+    pool.push_back(symbols[(start + i) % size]);
+  entries.insert(std::make_pair(key, e));
+}
+
+void NgramCounter::Add(const NgramSymbol &s)
+{
+  unsigned size = ring.size();
+  uint64_t n = current.n;
+  ring[n % size] = s;
+  uint64_t code = SymbolCode(s);
+  for (size_t k = 0; k < lengths.size(); k++) {
+    unsigned length = lengths[k];
+    hashes[k] = hashes[k] * Base + code;
+    if (n >= length)
+      hashes[k] -= SymbolCode(ring[(n - length) % size]) * powers[k];
+    if (n + 1 >= length)
+      Count(length, hashes[k], current.first + n + 1 - length, &ring[0], size, (n + 1 - length) % size);
+  }
+  if (n + 1 < maxLength)
+    current.head.push_back(s);
+  current.n++;
+}
+
+void NgramCounter::End()
+{
+  if (current.n == 0)
+    return;
+  unsigned size = ring.size();
+  uint64_t keep = std::min<uint64_t>(current.n, maxLength - 1);
+  for (uint64_t i = current.n - keep; i < current.n; i++)
+    current.tail.push_back(ring[i % size]);
+  segments.push_back(current);
+}
+
+void MergeNgrams(std::vector<NgramCounter> &counters, NgramTable &table)
+{
+  typedef NgramCounter::Key Key;
+  std::unordered_multimap<Key, size_t, NgramCounter::KeyHash> index;
+  for (size_t i = 0; i < table.ngrams.size(); i++) {
+    const Ngram &g = table.ngrams[i];
+    Key key = { HashSymbols(&g.symbols[0], g.symbols.size()), (unsigned) g.symbols.size() };
+    index.insert(std::make_pair(key, i));
+  }
+
+  auto add = [&](const Key &key, uint64_t count, uint64_t first, const NgramSymbol *symbols) {
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+      Ngram &g = table.ngrams[it->second];
+      if (!std::equal(g.symbols.begin(), g.symbols.end(), symbols))
+        continue;
+      g.count += count;
+      g.first = std::min(g.first, first);
+      return;
+    }
+    index.insert(std::make_pair(key, table.ngrams.size()));
+    Ngram g;
+    g.count = count;
+    g.first = first;
+    g.symbols.assign(symbols, symbols + key.length);
+    table.ngrams.push_back(g);
+  };
+
+  unsigned maxLength = 0;
+  for (auto &c : counters) {
+    maxLength = std::max(maxLength, c.maxLength);
+    for (auto &it : c.entries)
+      add(it.first, it.second.count, it.second.first, &c.pool[it.second.symbols]);
+    for (auto &s : c.segments)
+      table.total += s.n;
+  }
+
+  //Stitch segments: count n-grams which start before a segment and end in
+  //its first maxLength-1 records
+  std::vector<std::pair<uint64_t, std::pair<size_t, size_t> > > order;
+  for (size_t c = 0; c < counters.size(); c++)
+    for (size_t s = 0; s < counters[c].segments.size(); s++)
+      order.push_back(std::make_pair(counters[c].segments[s].first, std::make_pair(c, s)));
+  std::sort(order.begin(), order.end());
+
+  std::vector<NgramSymbol> carry;
+  std::vector<NgramSymbol> seq;
+  for (auto &o : order) {
+    const NgramCounter &c = counters[o.second.first];
+    const NgramCounter::Segment &s = c.segments[o.second.second];
+    seq = carry;
+    seq.insert(seq.end(), s.head.begin(), s.head.end());
+    for (size_t h = 0; h < s.head.size(); h++) {
+      size_t end = carry.size() + h + 1;
+      for (auto length : c.lengths) {
+        if (length > end || end - length >= carry.size())
+          continue;
+        size_t start = end - length;
+        Key key = { HashSymbols(&seq[start], length), length };
+        add(key, 1, s.first + h + 1 - length, &seq[start]);
+      }
+    }
+    carry.insert(carry.end(), s.tail.begin(), s.tail.end());
+    if (carry.size() > maxLength - 1)
+      carry.erase(carry.begin(), carry.end() - (maxLength - 1));
+  }
+
+  for (auto &c : counters) {
+    c.entries.clear();
+    c.pool.clear();
+    c.segments.clear();
+  }
+
+  std::sort(table.ngrams.begin(), table.ngrams.end(), [](const Ngram &a, const Ngram &b) {
+    if (a.count != b.count)
+      return a.count > b.count;
+    if (a.first != b.first)
+      return a.first < b.first;
+    return a.symbols.size() < b.symbols.size();
+  });
+}
+
+bool NgramTable::Write(const char *filename) const
+{
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  fprintf(f, "# mat-ngram %" PRIu64 "\n", total);
+  for (auto &g : ngrams) {
+    fprintf(f, "%" PRIu64 " %zu", g.count, g.symbols.size());
+    for (auto &s : g.symbols)
+      fprintf(f, " %" PRId64 " %" PRId64 " %" PRIu64 " %d", s.blockId, s.stride, s.size, s.isRead ? 1 : 0);
+    fprintf(f, "\n");
+  }
+  return fclose(f) == 0;
+}
+
+bool NgramTable::Read(const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  ngrams.clear();
+  if (fscanf(f, "# mat-ngram %" SCNu64, &total) != 1) {
+    fprintf(stderr, "%s: not an n-gram table\n", filename);
+    fclose(f);
+    return false;
+  }
+  Ngram g;
+  size_t length;
+  while (fscanf(f, "%" SCNu64 " %zu", &g.count, &length) == 2) {
+    g.first = ngrams.size();
+    g.symbols.resize(length);
+    for (auto &s : g.symbols) {
+      int isRead;
+      if (fscanf(f, "%" SCNd64 " %" SCNd64 " %" SCNu64 " %d", &s.blockId, &s.stride, &s.size, &isRead) != 4) {
+        fprintf(stderr, "%s: truncated n-gram table\n", filename);
+        fclose(f);
+        return false;
+      }
+      s.isRead = isRead != 0;
+    }
+    ngrams.push_back(g);
+  }
+  fclose(f);
+  return true;
+}
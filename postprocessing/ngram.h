@@ -0,0 +1,91 @@
+//N-grams over the sequence of memory graph nodes. Every access is encoded as
+//an integer symbol (blockId, stride, size, access type) and n-grams of the
+//requested lengths are counted with rolling hashes.
+
+#ifndef MAT_NGRAM_H
+#define MAT_NGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+struct NgramSymbol {
+  int64_t blockId;
+  int64_t stride;
+  uint64_t size;
+  bool isRead;
+
+  bool operator==(const NgramSymbol &o) const {
+    return blockId == o.blockId && stride == o.stride && size == o.size && isRead == o.isRead;
+  }
+};
+
+uint64_t SymbolCode(const NgramSymbol &s);
+
+struct Ngram {
+  uint64_t count;
+  uint64_t first;      //trace position of the first occurrence
+  std::vector<NgramSymbol> symbols;
+};
+
+//N-gram table file: a header line "# mat-ngram <total>" followed by one line
+//per n-gram: count length, then blockId stride size isRead for every element
+struct NgramTable {
+  NgramTable() : total(0) {}
+  bool Read(const char *filename);
+  bool Write(const char *filename) const;
+
+  uint64_t total;
+  std::vector<Ngram> ngrams;
+};
+
+//Counts n-grams of consecutive records; every worker owns one counter.
+//N-grams crossing the border of a segment are added by MergeNgrams().
+class NgramCounter {
+ public:
+  explicit NgramCounter(const std::vector<unsigned> &lengths);
+
+  void Begin(uint64_t first);
+  void Add(const NgramSymbol &s);
+  void End();
+
+ private:
+  friend void MergeNgrams(std::vector<NgramCounter> &counters, NgramTable &table);
+
+  //N-grams with the same hash are kept apart by comparing their symbols
+  struct Key {
+    uint64_t hash;
+    unsigned length;
+    bool operator==(const Key &o) const { return hash == o.hash && length == o.length; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &k) const { return k.hash ^ k.length; }
+  };
+  struct Entry { uint64_t count; uint64_t first; size_t symbols; };
+  struct Segment {
+    uint64_t first;
+    uint64_t n;
+    std::vector<NgramSymbol> head;
+    std::vector<NgramSymbol> tail;
+  };
+
+  void Count(unsigned length, uint64_t hash, uint64_t first, const NgramSymbol *symbols, unsigned stride, unsigned start);
+
+  std::vector<unsigned> lengths;
+  std::vector<uint64_t> powers;  //base^length for every length
+  unsigned maxLength;
+  std::unordered_multimap<Key, Entry, KeyHash> entries;
+  std::vector<NgramSymbol> pool;
+
+  //ring of the last maxLength symbols of the current segment
+  std::vector<NgramSymbol> ring;
+  std::vector<uint64_t> hashes;
+  std::vector<Segment> segments;
+  Segment current;
+};
+
+//Merge the counters into one table; segments are stitched in trace order
+void MergeNgrams(std::vector<NgramCounter> &counters, NgramTable &table);
+
+#endif
@@ -0,0 +1,70 @@
+#include "npy.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+NpyFile::NpyFile() : data(0), length(0), header(0) {}
+
+NpyFile::~NpyFile()
+{
+  Close();
+}
+
+bool NpyFile::Create(const std::string &p, const char *descr, size_t width, uint64_t rows)
+{
+  Close();
+  path = p;
+
+  //Magic, version, header length, then the header dict padded with spaces
+  //and a newline so the data starts at a multiple of 64 bytes
+  char dict[512];
+  int n = snprintf(dict, sizeof(dict), "{'descr': %s, 'fortran_order': False, 'shape': (%" PRIu64 ",), }", descr, rows);
+  if (n < 0 || n >= (int) sizeof(dict) - 64) {
+    fprintf(stderr, "%s: header too long\n", path.c_str());
+    return false;
+  }
+  header = (10 + n + 1 + 63) / 64 * 64;
+  length = header + width * rows;
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  if (ftruncate(fd, length) != 0) {
+    perror(path.c_str());
+    close(fd);
+    return false;
+  }
+  void *m = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) {
+    perror(path.c_str());
+    return false;
+  }
+  data = (char *) m;
+
+  uint16_t dictLength = header - 10;
+  memcpy(data, "\x93NUMPY\x01\x00", 8);
+  data[8] = dictLength & 0xff;
+  data[9] = dictLength >> 8;
+  memcpy(data + 10, dict, n);
+  memset(data + 10 + n, ' ', header - 10 - n - 1);
+  data[header - 1] = '\n';
+  return true;
+}
+
+bool NpyFile::Close()
+{
+  if (!data)
+    return true;
+  bool ok = munmap(data, length) == 0;
+  if (!ok)
+    perror(path.c_str());
+  data = 0;
+  return ok;
+}
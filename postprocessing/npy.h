@@ -0,0 +1,32 @@
+//Writer for numpy .npy files (format version 1.0) holding one fixed-width
+//column or a table of fixed-width records. The file is created with its
+//final size and mmaped, so workers can fill disjoint rows in parallel.
+//numpy.load(path, mmap_mode="r") maps it without reading it.
+
+#ifndef MAT_NPY_H
+#define MAT_NPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+class NpyFile {
+ public:
+  NpyFile();
+  ~NpyFile();
+
+  //descr is the numpy type as Python literal, e.g. "'<u8'" for a column or
+  //"[('a', '<i8'), ('b', '<u8')]" for a table; width is the size of a row
+  bool Create(const std::string &path, const char *descr, size_t width, uint64_t rows);
+  bool Close();
+
+  template <class T> T *Rows() { return (T *) (data + header); }
+
+ private:
+  std::string path;
+  char *data;
+  size_t length;
+  size_t header;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "parallel.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkRange {
+  std::mutex lock;
+  uint64_t begin;
+  uint64_t end;
+};
+
+static bool Pop(WorkRange &r, uint64_t &i)
+{
+  std::lock_guard<std::mutex> guard(r.lock);
+  if (r.begin >= r.end)
+    return false;
+  i = r.begin++;
+  return true;
+}
+
+//Move the upper half of the victim's range to the thief
+static bool Steal(WorkRange &victim, WorkRange &thief)
+{
+  uint64_t begin, end;
+  {
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (victim.begin >= victim.end)
+      return false;
+    uint64_t mid = victim.begin + (victim.end - victim.begin) / 2;
+    begin = mid;
+    end = victim.end;
+    victim.end = mid;
+  }
+  std::lock_guard<std::mutex> guard(thief.lock);
+  thief.begin = begin;
+  thief.end = end;
+  return true;
+}
+
+void ParallelFor(uint64_t n, unsigned threads, const std::function<void(uint64_t, unsigned)> &fn)
+{
+  if (threads == 0)
+    threads = 1;
+  if (threads > n)
+    threads = n ? n : 1;
+
+  std::vector<WorkRange> ranges(threads);
+  for (unsigned t = 0; t < threads; t++) {
+    ranges[t].begin = n * t / threads;
+    ranges[t].end = n * (t + 1) / threads;
+  }
+
+  auto work = [&](unsigned t) {
+    uint64_t i;
+    for (;;) {
+      while (Pop(ranges[t], i))
+        fn(i, t);
+      bool stolen = false;
+      for (unsigned v = 1; v < threads && !stolen; v++)
+        stolen = Steal(ranges[(t + v) % threads], ranges[t]);
+      if (!stolen)
+        return;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads; t++)
+    workers.push_back(std::thread(work, t));
+  work(0);
+  for (auto &w : workers)
+    w.join();
+}
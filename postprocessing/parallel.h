@@ -0,0 +1,15 @@
+//Work-stealing parallel loop. Every worker starts on its own slice of the
+//index range; a worker that runs out of work steals half of the remaining
+//range of another worker. Used for all-pairs comparisons where the cost of
+//an index varies a lot.
+
+#ifndef MAT_PARALLEL_H
+#define MAT_PARALLEL_H
+
+#include <stdint.h>
+#include <functional>
+
+//Call fn(i, worker) for every i in [0, n)
+void ParallelFor(uint64_t n, unsigned threads, const std::function<void(uint64_t, unsigned)> &fn);
+
+#endif
@@ -0,0 +1,176 @@
+#include "phase.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <unordered_map>
+
+#include "trace.h"
+
+static const unsigned StrideClasses = 9;
+
+static inline uint64_t Mix(uint64_t x)
+{
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+unsigned StrideClass(int64_t stride)
+{
+  if (stride == 0)
+    return 0;
+  uint64_t s = stride < 0 ? -(uint64_t) stride : stride;
+  unsigned c = s <= 8 ? 1 : s <= 64 ? 2 : s <= 4096 ? 3 : 4;
+  return stride < 0 ? c + 4 : c;
+}
+
+static double Manhattan(const std::vector<double> &a, const std::vector<double> &b)
+{
+  double d = 0;
+  for (size_t i = 0; i < a.size(); i++)
+    d += fabs(a[i] - b[i]);
+  return d;
+}
+
+void IntervalSignatures(Trace &trace, uint64_t interval, unsigned dims, Phases &phases)
+{
+  if (interval == 0)
+    interval = 1;
+  if (dims == 0)
+    dims = 1;
+  phases.interval = interval;
+
+  //Intervals may cross the border of a chunk, each chunk counts its part
+  typedef std::unordered_map<uint64_t, std::vector<double> > Partial;
+  std::vector<Partial> partial(trace.Chunks());
+  trace.ForEachWindow([&](TraceWindow &w) {
+    Partial &p = partial[w.chunk];
+    uint64_t current = UINT64_MAX;
+    std::vector<double> *v = 0;
+    for (size_t j = 0; j < w.records.size(); j++) {
+      const TraceRecord &r = w.records[j];
+      uint64_t i = (w.first + j) / interval;
+      if (i != current) {
+        current = i;
+        v = &p[i];
+        if (v->empty())
+          v->resize(dims);
+      }
+      uint64_t feature = (uint64_t) r.blockId * StrideClasses + StrideClass(r.stride);
+      (*v)[Mix(feature) % dims] += 1;
+    }
+  });
+
+  uint64_t n = (trace.Records() + interval - 1) / interval;
+  phases.signatures.assign(n, std::vector<double>(dims));
+  phases.accesses.assign(n, 0);
+  for (auto &p : partial)
+    for (auto &it : p)
+      for (unsigned d = 0; d < dims; d++)
+        phases.signatures[it.first][d] += it.second[d];
+  for (uint64_t i = 0; i < n; i++) {
+    double sum = 0;
+    for (auto x : phases.signatures[i])
+      sum += x;
+    phases.accesses[i] = sum;
+    if (sum > 0)
+      for (auto &x : phases.signatures[i])
+        x /= sum;
+  }
+}
+
+void ClusterPhases(double threshold, unsigned maxPhases, Phases &phases)
+{
+  if (maxPhases == 0)
+    maxPhases = 1;
+  uint64_t n = phases.signatures.size();
+  phases.phases.clear();
+  phases.sequence.assign(n, 0);
+  phases.distance.assign(n, 0);
+
+  for (uint64_t i = 0; i < n; i++) {
+    const std::vector<double> &s = phases.signatures[i];
+    size_t best = 0;
+    double bestDistance = INFINITY;
+    for (size_t p = 0; p < phases.phases.size(); p++) {
+      double d = Manhattan(s, phases.phases[p].centroid);
+      if (d < bestDistance) {
+        best = p;
+        bestDistance = d;
+      }
+    }
+    if (bestDistance >= threshold && phases.phases.size() < maxPhases) {
+      Phase phase = { s, 0, 0, i };
+      best = phases.phases.size();
+      phases.phases.push_back(phase);
+    }
+
+    //The centroid is the mean of the signatures of the phase
+    Phase &phase = phases.phases[best];
+    phase.intervals++;
+    phase.accesses += phases.accesses[i];
+    for (size_t d = 0; d < s.size(); d++)
+      phase.centroid[d] += (s[d] - phase.centroid[d]) / phase.intervals;
+    phases.sequence[i] = best;
+  }
+
+  //Representatives are picked with the final centroids
+  std::vector<double> nearest(phases.phases.size(), INFINITY);
+  for (uint64_t i = 0; i < n; i++) {
+    uint32_t p = phases.sequence[i];
+    double d = Manhattan(phases.signatures[i], phases.phases[p].centroid);
+    phases.distance[i] = d;
+    if (d < nearest[p]) {
+      nearest[p] = d;
+      phases.phases[p].representative = i;
+    }
+  }
+}
+
+void BuildPhaseGraphs(Trace &trace, const Phases &phases, std::vector<Graph> &graphs)
+{
+  std::vector<std::vector<GraphBuilder> > builders(phases.phases.size(), std::vector<GraphBuilder>(trace.Chunks()));
+  uint64_t interval = phases.interval;
+  trace.ForEachWindow([&](TraceWindow &w) {
+    uint64_t current = UINT64_MAX;
+    GraphBuilder *b = 0;
+    for (size_t j = 0; j < w.records.size(); j++) {
+      const TraceRecord &r = w.records[j];
+      uint64_t i = (w.first + j) / interval;
+      if (i != current) {
+        if (b)
+          b->End();
+        current = i;
+        b = &builders[phases.sequence[i]][w.chunk];
+        b->Begin(w.first + j);
+      }
+      NodeKey key = { r.blockId, r.stride, r.blockSize };
+      b->Add(key, r.isRead);
+    }
+    if (b)
+      b->End();
+  });
+
+  graphs.assign(phases.phases.size(), Graph());
+  for (size_t p = 0; p < builders.size(); p++)
+    graphs[p].Merge(builders[p]);
+}
+
+bool Phases::Write(const char *filename) const
+{
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  fprintf(f, "# mat-phase interval %" PRIu64 " intervals %zu phases %zu\n", interval, sequence.size(), phases.size());
+  fprintf(f, "# p phase intervals accesses representative\n");
+  for (size_t p = 0; p < phases.size(); p++)
+    fprintf(f, "p %zu %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", p, phases[p].intervals, phases[p].accesses,
+            phases[p].representative);
+  fprintf(f, "# i interval first phase distance\n");
+  for (size_t i = 0; i < sequence.size(); i++)
+    fprintf(f, "i %zu %" PRIu64 " %u %.4f\n", i, i * interval, sequence[i], distance[i]);
+  return fclose(f) == 0;
+}
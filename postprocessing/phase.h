@@ -0,0 +1,53 @@
+//Phase detection in the spirit of SimPoint. The trace is cut into intervals
+//of a fixed number of accesses; the signature of an interval counts its
+//accesses per (blockId, stride class), hashed into a vector of a few
+//dimensions and normalized to a sum of 1. Consecutive signatures are
+//clustered online: an interval joins the nearest phase if its Manhattan
+//distance to the phase centroid is below a threshold, else it starts a new
+//phase.
+
+#ifndef MAT_PHASE_H
+#define MAT_PHASE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "graph.h"
+
+class Trace;
+
+//0 for no stride, 1-4 for strides up to 8 bytes, a cache line, a page and
+//beyond, 5-8 for the same classes backwards
+unsigned StrideClass(int64_t stride);
+
+struct Phase {
+  std::vector<double> centroid;
+  uint64_t intervals;
+  uint64_t accesses;
+  uint64_t representative;  //interval closest to the centroid
+};
+
+struct Phases {
+  uint64_t interval;                  //accesses per interval
+  std::vector<std::vector<double> > signatures;
+  std::vector<uint64_t> accesses;     //accesses per interval, the last one may be short
+  std::vector<uint32_t> sequence;     //phase of every interval
+  std::vector<double> distance;       //distance of every interval to its phase centroid
+  std::vector<Phase> phases;
+
+  //Write the phases and the phase of every interval
+  bool Write(const char *filename) const;
+};
+
+//Compute the signature of every interval of a prepared trace
+void IntervalSignatures(Trace &trace, uint64_t interval, unsigned dims, Phases &phases);
+
+//Assign the intervals to phases in trace order. Once maxPhases phases exist
+//intervals join the nearest one.
+void ClusterPhases(double threshold, unsigned maxPhases, Phases &phases);
+
+//Build one graph from the accesses of each phase. The intervals of a phase
+//are treated as one access stream in trace order.
+void BuildPhaseGraphs(Trace &trace, const Phases &phases, std::vector<Graph> &graphs);
+
+#endif
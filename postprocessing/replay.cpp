@@ -0,0 +1,115 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+void TraceReplay::Run(Trace &trace)
+{
+  for (auto a : analyses)
+    a->Begin(trace.Chunks());
+  trace.ForEachWindow([&](TraceWindow &w) {
+    for (auto a : analyses)
+      a->Window(w);
+  });
+  for (auto a : analyses)
+    a->End();
+}
+
+void GraphAnalysis::Begin(unsigned chunks)
+{
+  builders.assign(chunks, GraphBuilder());
+}
+
+void GraphAnalysis::Window(const TraceWindow &w)
+{
+  GraphBuilder &b = builders[w.chunk];
+  b.Begin(w.first);
+  for (auto &r : w.records) {
+    NodeKey key = { r.blockId, r.stride, r.blockSize };
+    b.Add(key, r.isRead);
+  }
+  b.End();
+}
+
+void GraphAnalysis::End()
+{
+  graph.Merge(builders);
+}
+
+NgramAnalysis::NgramAnalysis(const std::vector<unsigned> &l, double r) : lengths(l), ratio(r) {}
+
+void NgramAnalysis::Begin(unsigned chunks)
+{
+  counters.assign(chunks, NgramCounter(lengths));
+}
+
+void NgramAnalysis::Window(const TraceWindow &w)
+{
+  NgramCounter &c = counters[w.chunk];
+  c.Begin(w.first);
+  for (auto &r : w.records) {
+    NgramSymbol s = { r.blockId, r.stride, r.blockSize, r.isRead };
+    c.Add(s);
+  }
+  c.End();
+}
+
+void NgramAnalysis::End()
+{
+  MergeNgrams(counters, table);
+  size_t keep = 0;
+  while (keep < table.ngrams.size() && table.ngrams[keep].count > ratio * table.total)
+    keep++;
+  table.ngrams.resize(keep);
+}
+
+HeatmapAnalysis::HeatmapAnalysis(unsigned b) : bins(b ? b : 1) {}
+
+void HeatmapAnalysis::Begin(unsigned chunks)
+{
+  partial.resize(chunks);
+}
+
+void HeatmapAnalysis::Window(const TraceWindow &w)
+{
+  Rows &rows = partial[w.chunk];
+  for (auto &r : w.records) {
+    Row &row = rows[r.blockId];
+    if (row.counts.empty())
+      row.counts.resize(bins);
+    row.blockSize = r.blockSize;
+    uint64_t bin = r.blockSize ? (uint64_t) r.offset * bins / r.blockSize : 0;
+    row.counts[bin < bins ? bin : bins - 1]++;
+  }
+}
+
+void HeatmapAnalysis::End()
+{
+  for (auto &p : partial) {
+    for (auto &it : p) {
+      Row &row = rows[it.first];
+      if (row.counts.empty())
+        row.counts.resize(bins);
+      row.blockSize = it.second.blockSize;
+      for (unsigned b = 0; b < bins; b++)
+        row.counts[b] += it.second.counts[b];
+    }
+    p.clear();
+  }
+}
+
+bool HeatmapAnalysis::Write(const char *filename) const
+{
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  for (auto &it : rows) {
+    fprintf(f, "%" PRId64 " %" PRIu64, it.first, it.second.blockSize);
+    for (auto c : it.second.counts)
+      fprintf(f, " %" PRIu64, c);
+    fprintf(f, "\n");
+  }
+  return fclose(f) == 0;
+}
@@ -0,0 +1,91 @@
+//Runs several analyses over a single decode pass of a trace. Analyses are
+//registered with a TraceReplay and get every window of records exactly as
+//Trace::ForEachWindow() delivers it: in parallel with one worker per chunk,
+//the windows of a chunk in reverse order, each window in trace order. An
+//analysis keeps one state per chunk, so Window() needs no locking, and
+//combines the states in End(). Analyses that depend on the order of the
+//records keep segments and stitch them in End(), as GraphBuilder does.
+
+#ifndef MAT_REPLAY_H
+#define MAT_REPLAY_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "graph.h"
+#include "ngram.h"
+#include "trace.h"
+
+class TraceAnalysis {
+ public:
+  virtual ~TraceAnalysis() {}
+  virtual void Begin(unsigned chunks) {}
+  virtual void Window(const TraceWindow &w) = 0;
+  virtual void End() {}
+};
+
+class TraceReplay {
+ public:
+  void Register(TraceAnalysis *analysis) { analyses.push_back(analysis); }
+
+  //Decode the prepared trace once and hand every window to all analyses
+  void Run(Trace &trace);
+
+ private:
+  std::vector<TraceAnalysis *> analyses;
+};
+
+//Memory graph, the same as Graph::Build()
+class GraphAnalysis : public TraceAnalysis {
+ public:
+  void Begin(unsigned chunks);
+  void Window(const TraceWindow &w);
+  void End();
+
+  Graph graph;
+
+ private:
+  std::vector<GraphBuilder> builders;
+};
+
+//N-gram table as written by mat-ngram, keeping n-grams seen in more than
+//ratio * total accesses
+class NgramAnalysis : public TraceAnalysis {
+ public:
+  NgramAnalysis(const std::vector<unsigned> &lengths, double ratio);
+  void Begin(unsigned chunks);
+  void Window(const TraceWindow &w);
+  void End();
+
+  NgramTable table;
+
+ private:
+  std::vector<unsigned> lengths;
+  double ratio;
+  std::vector<NgramCounter> counters;
+};
+
+//Accesses per block and offset bin. End() folds the counts of the chunks
+//into rows and may be called again after more windows, e.g. for snapshots.
+class HeatmapAnalysis : public TraceAnalysis {
+ public:
+  struct Row { uint64_t blockSize; std::vector<uint64_t> counts; };
+  typedef std::map<int64_t, Row> Rows;
+
+  explicit HeatmapAnalysis(unsigned bins = 64);
+  void Begin(unsigned chunks);
+  void Window(const TraceWindow &w);
+  void End();
+
+  //One line per block: blockId blockSize, then the count of every bin
+  bool Write(const char *filename) const;
+
+  Rows rows;
+
+ private:
+  unsigned bins;
+  std::vector<Rows> partial;
+};
+
+#endif
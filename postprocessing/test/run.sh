@@ -0,0 +1,35 @@
+#!/bin/sh
+#Regression test of the native tools: make -C postprocessing test
+#a.dot, a.ngrams/b.ngrams and a.dist/ab.dist are the outputs of create_graph() of
+#generate_graph.py and of distance.py for a.txt and b.txt. Every tool has to
+#reproduce them with any number of threads and window size.
+cd "$(dirname "$0")" || exit 1
+out=$(mktemp -d) || exit 1
+trap 'rm -rf "$out"' EXIT
+failed=0
+
+check() {
+  if ! cmp -s "$1" "$2"; then
+    echo "FAIL: $3"
+    diff "$1" "$2" | head -5
+    failed=1
+  fi
+}
+
+for t in 1 3 8; do
+  for w in "" "-w 97"; do
+    ../mat-graph -t $t $w -d $out/a.dot a.txt > /dev/null || failed=1
+    check a.dot $out/a.dot "mat-graph -t $t $w"
+    for x in a b; do
+      ../mat-ngram -t $t $w -l 2,4,8 -r 0.003 -o $out/$x.ngrams $x.txt > /dev/null || failed=1
+      check $x.ngrams $out/$x.ngrams "mat-ngram -t $t $w $x.txt"
+    done
+  done
+  ../mat-distance -t $t -o $out/a.dist a.ngrams > /dev/null || failed=1
+  check a.dist $out/a.dist "mat-distance -t $t a.ngrams"
+  ../mat-distance -t $t -o $out/ab a.ngrams b.ngrams > $out/ab.dist || failed=1
+  check ab.dist $out/ab.dist "mat-distance -t $t a.ngrams b.ngrams"
+done
+
+[ $failed = 0 ] && echo "all tests passed"
+exit $failed
@@ -0,0 +1,361 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+//Per block information collected in the first pass over a chunk
+struct BlockSpan {
+  int64_t firstOffset;
+  int64_t lastOffset;
+  int64_t prevOffset;
+  uint64_t count;
+};
+typedef std::unordered_map<uint64_t, BlockSpan> BlockSpans;
+
+struct Trace::Blocks {
+  std::unordered_map<uint64_t, int64_t> ids;
+  //stride of the last access to a block: same as the stride before it
+  std::unordered_map<uint64_t, int64_t> lastStride;
+  //offset of the first access to a block after the end of a chunk
+  std::vector<std::unordered_map<uint64_t, int64_t> > next;
+};
+
+static inline const char *ParseInt(const char *p, const char *end, int64_t &v)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  bool neg = false;
+  if (p < end && *p == '-') {
+    neg = true;
+    p++;
+  }
+  const char *start = p;
+  uint64_t x = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+    x = x * 10 + (*p++ - '0');
+  if (p == start)
+    return 0;
+  v = neg ? -(int64_t) x : (int64_t) x;
+  return p;
+}
+
+const char *ParseRecord(const char *p, const char *end, TraceRecord &r, int *columns)
+{
+  while (p < end) {
+    int64_t f[10];
+    int n = 0;
+    const char *q = p;
+    while (n < 10) {
+      const char *t = ParseInt(q, end, f[n]);
+      if (!t)
+        break;
+      q = t;
+      n++;
+    }
+    const char *eol = (const char *) memchr(q, '\n', end - q);
+    const char *next = eol ? eol + 1 : end;
+    if (n >= 7) {
+      r.ip = f[0];
+      r.ea = f[1];
+      r.offset = f[2];
+      r.block = f[3];
+      r.isRead = f[4] != 0;
+      r.size = f[5];
+      r.blockSize = f[6];
+      r.blockId = n >= 9 ? f[7] : -1;
+      r.stride = n >= 9 ? f[8] : 0;
+      r.site = n == 8 ? f[7] : n == 10 ? f[9] : -1;
+      if (columns)
+        *columns = n;
+      return next;
+    }
+    p = next;
+  }
+  return 0;
+}
+
+unsigned DefaultThreads()
+{
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+Trace::Trace() : data(0), length(0), prepared(false), sites(false), records(0), blocks(0) {}
+
+Trace::~Trace()
+{
+  if (data)
+    munmap((void *) data, length);
+  delete blocks;
+}
+
+bool Trace::Open(const char *filename)
+{
+  path = filename;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror(filename);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(filename);
+    close(fd);
+    return false;
+  }
+  length = st.st_size;
+  if (length > 0) {
+    void *m = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+      perror(filename);
+      close(fd);
+      return false;
+    }
+    madvise(m, length, MADV_SEQUENTIAL);
+    data = (const char *) m;
+  }
+  close(fd);
+
+  TraceRecord r;
+  int columns = 0;
+  if (data)
+    ParseRecord(data, data + length, r, &columns);
+  prepared = columns >= 9;
+  sites = columns == 8 || columns == 10;
+  return true;
+}
+
+void Trace::Prepare(unsigned threads, uint64_t windowSize)
+{
+  if (threads == 0)
+    threads = 1;
+  if (windowSize == 0)
+    windowSize = 1;
+
+  //Split into chunks at line boundaries
+  chunks.clear();
+  const char *end = data + length;
+  const char *p = data;
+  for (unsigned c = 0; c < threads && p < end; c++) {
+    const char *e = c + 1 == threads ? end : data + length / threads * (c + 1);
+    if (e < p)
+      e = p;
+    if (e < end) {
+      const char *eol = (const char *) memchr(e, '\n', end - e);
+      e = eol ? eol + 1 : end;
+    }
+    Range range = { p, e, 0, (unsigned) chunks.size() };
+    chunks.push_back(range);
+    p = e;
+  }
+
+  //First pass: count records, cut windows and summarize block accesses
+  std::vector<std::vector<Range> > chunkWindows(chunks.size());
+  std::vector<BlockSpans> spans(chunks.size());
+  std::vector<uint64_t> counts(chunks.size());
+  std::vector<std::thread> workers;
+  for (unsigned c = 0; c < chunks.size(); c++)
+    workers.push_back(std::thread([&, c]() {
+      TraceRecord r;
+      const char *q = chunks[c].begin;
+      const char *e = chunks[c].end;
+      const char *start = q;
+      uint64_t n = 0, inWindow = 0;
+      while ((q = ParseRecord(q, e, r))) {
+        n++;
+        if (++inWindow == windowSize) {
+          Range w = { start, q, 0, c };
+          chunkWindows[c].push_back(w);
+          start = q;
+          inWindow = 0;
+        }
+        if (prepared) {
+          spans[c].insert(std::make_pair(r.block, BlockSpan()));
+          continue;
+        }
+        auto it = spans[c].find(r.block);
+        if (it == spans[c].end()) {
+          BlockSpan s = { r.offset, r.offset, 0, 1 };
+          spans[c].insert(std::make_pair(r.block, s));
+        } else {
+          it->second.prevOffset = it->second.lastOffset;
+          it->second.lastOffset = r.offset;
+          it->second.count++;
+        }
+      }
+      if (inWindow > 0) {
+        Range w = { start, e, 0, c };
+        chunkWindows[c].push_back(w);
+      }
+      counts[c] = n;
+    }));
+  for (auto &w : workers)
+    w.join();
+
+  records = 0;
+  windows.clear();
+  for (unsigned c = 0; c < chunks.size(); c++) {
+    chunks[c].first = records;
+    uint64_t first = records;
+    for (auto &w : chunkWindows[c]) {
+      w.first = first;
+      first += std::min<uint64_t>(windowSize, records + counts[c] - first);
+      windows.push_back(w);
+    }
+    records += counts[c];
+  }
+
+  delete blocks;
+  blocks = 0;
+  ranks.clear();
+  preparedStarts.clear();
+  if (prepared) {
+    for (auto &s : spans)
+      for (auto &it : s)
+        preparedStarts.push_back(it.first);
+    std::sort(preparedStarts.begin(), preparedStarts.end());
+    preparedStarts.erase(std::unique(preparedStarts.begin(), preparedStarts.end()), preparedStarts.end());
+    return;
+  }
+  blocks = new Blocks;
+
+  //Block IDs are assigned in the order of the block start addresses
+  std::vector<int64_t> starts;
+  for (auto &s : spans)
+    for (auto &it : s)
+      starts.push_back((int64_t) it.first);
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+  for (size_t i = 0; i < starts.size(); i++)
+    blocks->ids[(uint64_t) starts[i]] = i;
+
+  //The last access to a block repeats the stride of the access before it
+  BlockSpans total;
+  for (auto &s : spans)
+    for (auto &it : s) {
+      auto t = total.find(it.first);
+      if (t == total.end()) {
+        total.insert(it);
+        continue;
+      }
+      if (it.second.count >= 2)
+        t->second.prevOffset = it.second.prevOffset;
+      else
+        t->second.prevOffset = t->second.lastOffset;
+      t->second.lastOffset = it.second.lastOffset;
+      t->second.count += it.second.count;
+    }
+  for (auto &it : total)
+    blocks->lastStride[it.first] = it.second.count >= 2 ? it.second.lastOffset - it.second.prevOffset : 0;
+
+  //Offsets of the next access to each block beyond the end of every chunk
+  blocks->next.resize(chunks.size());
+  for (int c = (int) chunks.size() - 2; c >= 0; c--) {
+    blocks->next[c] = blocks->next[c + 1];
+    for (auto &it : spans[c + 1])
+      blocks->next[c][it.first] = it.second.firstOffset;
+  }
+}
+
+std::vector<uint64_t> Trace::BlockStarts() const
+{
+  if (prepared)
+    return preparedStarts;
+  std::vector<uint64_t> starts;
+  if (blocks)
+    for (auto &it : blocks->ids)
+      starts.push_back(it.first);
+  std::sort(starts.begin(), starts.end());
+  return starts;
+}
+
+void Trace::RankBlocks(const std::vector<uint64_t> &starts)
+{
+  if (prepared)
+    ranks = starts;
+  if (!blocks)
+    return;
+  for (auto &it : blocks->ids)
+    it.second = std::lower_bound(starts.begin(), starts.end(), it.first) - starts.begin();
+}
+
+void Trace::ResolveChunk(unsigned c, const std::function<void(TraceWindow &)> &fn)
+{
+  std::unordered_map<uint64_t, int64_t> next;
+  if (blocks)
+    next = blocks->next[c];
+
+  //Strides depend on the following accesses, so walk the windows backwards
+  TraceWindow window;
+  window.chunk = c;
+  for (size_t i = windows.size(); i-- > 0;) {
+    const Range &w = windows[i];
+    if (w.chunk != c)
+      continue;
+    window.index = i;
+    window.first = w.first;
+    window.records.clear();
+    TraceRecord r;
+    const char *q = w.begin;
+    while ((q = ParseRecord(q, w.end, r)))
+      window.records.push_back(r);
+
+    if (blocks) {
+      for (size_t j = window.records.size(); j-- > 0;) {
+        TraceRecord &rec = window.records[j];
+        rec.blockId = sites && rec.site > 0 ? rec.site : blocks->ids.at(rec.block);
+        auto it = next.find(rec.block);
+        if (it != next.end()) {
+          rec.stride = it->second - rec.offset;
+          it->second = rec.offset;
+        } else {
+          rec.stride = blocks->lastStride.at(rec.block);
+          next.insert(std::make_pair(rec.block, rec.offset));
+        }
+      }
+    } else if (!ranks.empty()) {
+      for (auto &rec : window.records)
+        if (!sites || rec.site == 0)
+          rec.blockId = std::lower_bound(ranks.begin(), ranks.end(), rec.block) - ranks.begin();
+    }
+    fn(window);
+  }
+}
+
+void Trace::ForEachWindow(const std::function<void(TraceWindow &)> &fn)
+{
+  std::vector<std::thread> workers;
+  for (unsigned c = 0; c < chunks.size(); c++)
+    workers.push_back(std::thread(&Trace::ResolveChunk, this, c, std::cref(fn)));
+  for (auto &w : workers)
+    w.join();
+}
+
+TraceIterator Trace::Begin() const
+{
+  return TraceIterator(data, data + length);
+}
+
+TraceIterator Trace::Chunk(unsigned c) const
+{
+  return TraceIterator(chunks[c].begin, chunks[c].end);
+}
+
+void Trace::ForEachChunk(const std::function<void(unsigned, TraceIterator &)> &fn) const
+{
+  std::vector<std::thread> workers;
+  for (unsigned c = 0; c < chunks.size(); c++)
+    workers.push_back(std::thread([&, c]() {
+      TraceIterator it = Chunk(c);
+      fn(c, it);
+    }));
+  for (auto &w : workers)
+    w.join();
+}
@@ -0,0 +1,117 @@
+//Reader for the memory trace written by the PIN tool (memtrace.txt).
+//Each line holds: ip ea offset blockStart type size blockSize, followed by
+//the allocation site of the block if the tool ran with -site_depth. Traces
+//that went through generate_graph.py prepare_input() have the columns
+//blockId stride instead, followed by the site if the block IDs are sites.
+//The trace is mmaped and split into chunks which are processed by one
+//worker each.
+
+#ifndef MAT_TRACE_H
+#define MAT_TRACE_H
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct TraceRecord {
+  uint64_t ip;
+  uint64_t ea;
+  int64_t  offset;     //distance of ea to the start of the memory block
+  uint64_t block;      //start address of the memory block
+  uint32_t size;       //size of the access
+  bool     isRead;
+  uint64_t blockSize;
+  int64_t  blockId;    //rank of block among all block start addresses
+  int64_t  stride;     //offset of next access to the same block minus offset
+  int64_t  site;       //allocation site of the block, -1 if not traced
+};
+
+//Consecutive records handed to the analysis. Windows of one chunk are
+//delivered by the same worker, but not in trace order.
+struct TraceWindow {
+  unsigned chunk;
+  uint64_t index;      //position of the window in the trace
+  uint64_t first;      //position of records[0] in the trace
+  std::vector<TraceRecord> records;
+};
+
+class TraceIterator;
+
+class Trace {
+ public:
+  Trace();
+  ~Trace();
+
+  bool Open(const char *path);
+
+  //Split the trace into chunks and assign block IDs and strides the same way
+  //generate_graph.py prepare_input() does. Traces with 9 columns are used as
+  //they are; in traces with allocation sites the site is the block ID, except
+  //for blocks with site 0, which keep their rank.
+  void Prepare(unsigned threads, uint64_t windowSize = 1 << 20);
+
+  //Start addresses of the memory blocks in the trace, in ascending order
+  std::vector<uint64_t> BlockStarts() const;
+
+  //Number blocks by their rank in starts (ascending, a superset of the
+  //blocks of this trace), so several traces of one address space agree on
+  //their block IDs. Blocks with an allocation site keep the site. Prepared
+  //traces are renumbered by their blockStart column as well.
+  void RankBlocks(const std::vector<uint64_t> &starts);
+
+  //Call fn for every window, in parallel with one worker per chunk
+  void ForEachWindow(const std::function<void(TraceWindow &)> &fn);
+
+  //Iterate over the records of the whole trace or of one chunk in trace
+  //order, decoded straight from the mapping
+  TraceIterator Begin() const;
+  TraceIterator Chunk(unsigned c) const;
+
+  //Call fn with an iterator over every chunk, in parallel
+  void ForEachChunk(const std::function<void(unsigned, TraceIterator &)> &fn) const;
+
+  uint64_t Records() const { return records; }
+  uint64_t Windows() const { return windows.size(); }
+  unsigned Chunks() const { return chunks.size(); }
+
+ private:
+  struct Range { const char *begin; const char *end; uint64_t first; unsigned chunk; };
+
+  void ResolveChunk(unsigned c, const std::function<void(TraceWindow &)> &fn);
+
+  std::string path;
+  const char *data;
+  size_t length;
+  bool prepared;
+  bool sites;
+  uint64_t records;
+  std::vector<Range> chunks;
+  std::vector<Range> windows;
+  std::vector<uint64_t> preparedStarts;  //block starts of a prepared trace
+  std::vector<uint64_t> ranks;           //set by RankBlocks() for prepared traces
+  struct Blocks;
+  Blocks *blocks;
+};
+
+//Parse one record starting at p. Lines with less than 7 columns (e.g. the
+//"0 0" marker written when instrumentation is switched off) are skipped.
+//Returns the start of the next line or 0 at the end of the buffer.
+const char *ParseRecord(const char *p, const char *end, TraceRecord &r, int *columns = 0);
+
+//Forward iterator over records of the mapped trace. Block IDs and strides
+//are only set for prepared traces, as they depend on later records; use
+//ForEachWindow() or TraceReplay (replay.h) to get them.
+class TraceIterator {
+ public:
+  TraceIterator(const char *begin, const char *end) : p(begin), end(end) {}
+  bool Next(TraceRecord &r) { return p && (p = ParseRecord(p, end, r)) != 0; }
+
+ private:
+  const char *p;
+  const char *end;
+};
+
+unsigned DefaultThreads();
+
+#endif